@@ -1,20 +1,118 @@
+#define _GNU_SOURCE     // sync_file_range (ver FUERA DE MEMORIA)
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <omp.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
 
-#define N 50  // Tamaño del ecosistema (NxN)
 #define PLANT 1
 #define HERBIVORE 2
 #define CARNIVORE 3
 #define EMPTY 0
-#define MAX_TICKS_SIN_COMER 3
-#define ENERGIA_REPRODUCCION 2
-#define ENERGIA_NUEVO 2
-#define EDAD_MAXIMA 10
 
-// Estructura para la celda del ecosistema
+// Parámetros de las reglas. Cada mundo lleva los suyos, así un ensamble puede
+// barrerlos sin recompilar (ver ENSAMBLE).
+typedef struct {
+    int32_t max_ticks_sin_comer;    // Muere de hambre al llegar a este valor
+    int32_t energia_reproduccion;   // Energía mínima para reproducirse
+    int32_t energia_nuevo;          // Energía de una cría
+    int32_t edad_maxima;            // Muere de vejez al llegar a esta edad
+    int32_t prob_siembra;           // % de colonizar cada vecino vacío por tick
+    int32_t radio_percepcion;       // Celdas a las que un herbívoro ve plantas y carnívoros (0: solo sus vecinos)
+} Reglas;
+
+// Tope de la energía de un animal (la de su plano de un byte). Las comidas
+// suman sin límite en las reglas, así que la energía se satura aquí al
+// guardarse (ver reglas_validas).
+#define ENERGIA_MAXIMA INT8_MAX
+
+#define VALORES_REGLAS_BASE 3, 2, 2, 10, 30, 0
+static const Reglas REGLAS_BASE = {VALORES_REGLAS_BASE};
+
+// Para las funciones de las reglas que tienen que quedar dentro de cada
+// núcleo especializado (ver NÚCLEOS)
+#define EN_LINEA static inline __attribute__((always_inline))
+
+// Parámetros que se pueden dar como lista en la línea de comandos: las
+// reglas y las poblaciones iniciales
+#define PARAM_HAMBRE        0
+#define PARAM_REPRODUCCION  1
+#define PARAM_ENERGIA_CRIA  2
+#define PARAM_EDAD          3
+#define PARAM_SIEMBRA       4
+#define PARAM_PERCEPCION    5
+#define PARAM_PLANTAS       6
+#define PARAM_HERBIVOROS    7
+#define PARAM_CARNIVOROS    8
+#define NUM_PARAMETROS      9
+#define NUM_REGLAS          6   // Los primeros NUM_PARAMETROS
+
+// Opción (sin guiones), columna de los informes y rango de cada parámetro
+static const struct {
+    const char *opcion;
+    const char *columna;
+    long minimo, maximo;
+} PARAMETROS[NUM_PARAMETROS] = {
+    {"max-hambre",           "max_ticks_sin_comer",  1, 250},
+    {"energia-reproduccion", "energia_reproduccion", 1, 100},
+    {"energia-cria",         "energia_nuevo",        1, 100},
+    {"edad-maxima",          "edad_maxima",          1, 250},
+    {"prob-siembra",         "prob_siembra",         0, 100},
+    {"radio-percepcion",     "radio_percepcion",     0, 1000},
+    {"plantas",              "plantas",              0, LONG_MAX},
+    {"herbivoros",           "herbivoros",           0, LONG_MAX},
+    {"carnivoros",           "carnivoros",           0, LONG_MAX},
+};
+
+static Reglas reglas_de(const long valores[NUM_PARAMETROS]) {
+    return (Reglas) {
+        .max_ticks_sin_comer = (int32_t) valores[PARAM_HAMBRE],
+        .energia_reproduccion = (int32_t) valores[PARAM_REPRODUCCION],
+        .energia_nuevo = (int32_t) valores[PARAM_ENERGIA_CRIA],
+        .edad_maxima = (int32_t) valores[PARAM_EDAD],
+        .prob_siembra = (int32_t) valores[PARAM_SIEMBRA],
+        .radio_percepcion = (int32_t) valores[PARAM_PERCEPCION],
+    };
+}
+
+// Los rangos garantizan que edad y hambre caben en sus planos de un byte. La
+// energía se satura en ENERGIA_MAXIMA; como los umbrales de energía no pasan
+// de 100, un animal saturado los sigue superando y el tope solo descarta la
+// reserva que pasa de ahí.
+static bool reglas_validas(const Reglas *rg) {
+    const long v[NUM_REGLAS] = {
+        rg->max_ticks_sin_comer, rg->energia_reproduccion, rg->energia_nuevo, rg->edad_maxima, rg->prob_siembra,
+        rg->radio_percepcion,
+    };
+    for (int p = 0; p < NUM_REGLAS; p++)
+        if (v[p] < PARAMETROS[p].minimo || v[p] > PARAMETROS[p].maximo) return false;
+    return true;
+}
+
+// Modo de representación (ver AGENTES)
+#define MODO_AUTO      0
+#define MODO_DENSO     1
+#define MODO_DISPERSO  2
+#define OCUPACION_DISPERSO 5    // % de celdas ocupadas por debajo del cual se pasa a listas
+#define OCUPACION_DENSO    10   // % por encima del cual se vuelve a la rejilla
+
+// Valores de una celda, para leer o escribir un animal de una vez
 typedef struct {
     int tipo;               // Tipo de entidad
     int energia;            // Solo usado por herbívoros/carnívoros
@@ -22,575 +120,5096 @@ typedef struct {
     int edad;               // Para muerte por vejez
 } Celda;
 
-Celda ecosistema[N][N];
+// Estado del ecosistema como estructura de arreglos: un plano por campo, de un
+// byte por celda (4 bytes por celda en total). Las búsquedas de vecinos solo
+// recorren el plano de tipos.
+typedef struct {
+    uint8_t *tipo;
+    int8_t *energia;
+    uint8_t *ticks_sin_comer;
+    uint8_t *edad;
+} Planos;
+
+#define BYTES_CELDA 4   // Suma de los planos
+
+#define MAX_BARRIDO 16   // Valores por lista (benchmark y ensamble)
+
+#define DISTRIBUCION_UNIFORME  0
+#define DISTRIBUCION_GRUMOS    1   // Manchas sorteadas con la semilla
+#define DISTRIBUCION_IMAGEN    2   // Pesos de un PGM
+
+// Dónde caen los agentes iniciales: una rejilla de pesos (0 a 255) que se
+// estira sobre el mundo (ver inicializar_ecosistema)
+typedef struct {
+    int tipo;               // DISTRIBUCION_*
+    int filas, columnas;    // De la imagen (la de grumos se sortea al colocar)
+    uint8_t *peso;
+} Distribucion;
+
+// Parámetros de la corrida (línea de comandos)
+typedef struct {
+    int ancho;              // Columnas del ecosistema
+    int alto;               // Filas del ecosistema
+    int ticks;              // Número de ticks a simular
+    uint64_t semilla;       // Semilla del generador (misma semilla => misma corrida)
+    bool semilla_dada;      // Si vino por -s (si no, el benchmark usa una fija)
+    long valores[NUM_PARAMETROS][MAX_BARRIDO]; // Reglas y poblaciones iniciales (caps a ancho*alto)
+    int num_valores[NUM_PARAMETROS];           // Más de uno solo con --ensamble
+    int modo;               // MODO_AUTO, MODO_DENSO o MODO_DISPERSO
+    Distribucion distribucion; // Colocación inicial
+    bool toroide;           // Bordes que dan la vuelta (si no, acotado)
+    int vecinos;            // 4 (von Neumann) u 8 (Moore)
+    int checkpoint_cada;    // Ticks entre checkpoints (0: ninguno)
+    const char *checkpoint_ruta;
+    bool comprimir;         // Checkpoints comprimidos por tesela
+    const char *restaurar;  // Checkpoint del que continuar (NULL: empezar de cero)
+    int salida;             // SALIDA_* (ver SALIDA)
+    int salida_cada;        // Ticks entre cuadros
+    const char *salida_ruta;
+    const char *estadisticas; // Serie temporal CSV/JSON (NULL: ninguna)
+    bool benchmark;         // Barrido de tamaños, densidades e hilos en vez de una corrida
+    long tamanos[MAX_BARRIDO];
+    int num_tamanos;
+    long densidades[MAX_BARRIDO];                 // % de celdas ocupadas
+    int num_densidades;
+    long hilos[MAX_BARRIDO];
+    int num_hilos;                                // 0: potencias de 2 hasta el máximo
+    const char *benchmark_ruta;                   // CSV, o JSON si termina en .json (NULL: stdout)
+    bool ensamble;          // Un mundo por combinación de valores y réplica
+    int replicas;           // Semillas por combinación (semilla, semilla + 1, ...)
+    const char *ensamble_ruta;                    // CSV, o JSON si termina en .json (NULL: stdout)
+    const char *traza;      // Traza de la instrumentación (NULL: ninguna)
+    const char *disco;      // Directorio de la rejilla fuera de memoria (NULL: en memoria)
+    size_t presupuesto;     // Bytes residentes de la rejilla fuera de memoria
+} Config;
+
+// Máscaras de bits por fila: bit j de la palabra j/64 encendido si la celda
+// cumple la condición. Cada fila lleva una palabra fantasma a cada lado y hay
+// una fila fantasma arriba y abajo (en cero con bordes, copia del lado
+// opuesto en un toroide), así desplazar hacia los vecinos nunca se sale del
+// arreglo ni necesita comprobar bordes.
+typedef struct {
+    int palabras;           // Palabras de datos por fila: ceil(ancho / 64)
+    int paso;               // palabras + 2 fantasmas
+    uint64_t *tipo[4];      // Ocupación por tipo (EMPTY, PLANT, HERBIVORE, CARNIVORE)
+    uint64_t *seguro;       // Vacía y sin carnívoros vecinos (escape seguro)
+    uint64_t *cerca_planta; // Vacía y con alguna planta vecina
+    int corrimiento;        // Posición a la que entra el vecino este en la última palabra (ver este)
+} Mascaras;
+
+// El ecosistema se reparte en teselas de TESELA_FILAS x (64 * TESELA_PALABRAS)
+// celdas (32 KiB de planos), el tamaño de trabajo que se le da a un hilo.
+#define TESELA_FILAS 64
+#define TESELA_PALABRAS 2
+
+// Teselas con agentes de cada especie, para saltar las vacías y repartir la
+// carga según el número real de agentes
+typedef struct {
+    int filas;              // Teselas a lo alto
+    int columnas;           // Teselas a lo ancho
+    int total;
+    uint32_t *conteo[4];    // Agentes de cada tipo por tesela (sin EMPTY)
+    uint32_t *activas[4];   // Teselas con agentes del tipo, las más pobladas primero
+    int num_activas[4];
+    unsigned char *sucia;   // Teselas escritas en "siguiente" desde las últimas máscaras
+    unsigned char *derivar; // Teselas cuyas máscaras derivadas hay que rehacer (ver actualizar_mascaras)
+    bool en_orden;          // Activas en orden de tesela y no de población (fuera de memoria)
+} Teselas;
+
+// Vecindad y bordes del mundo (ver TOPOLOGÍA)
+typedef struct {
+    int vecinos;            // 4 (von Neumann) u 8 (Moore)
+    bool envolver_filas;    // La fila de abajo continúa en la de arriba
+    bool envolver_columnas; // La columna derecha continúa en la izquierda
+    int *fila[3];           // fila[di + 1][i]: fila i + di, ya envuelta (-1 si cae fuera)
+    int *columna[3];        // Ídem para las columnas
+} Topologia;
+
+// Lado de los bloques del campo de percepción: la resolución con que un
+// herbívoro ve lejos
+#define LADO_CAMPO 8
+
+// Plantas y carnívoros por bloques de LADO_CAMPO x LADO_CAMPO celdas del mundo
+// completo, para la percepción a distancia (ver CAMPO). Solo se llenan las
+// entradas de PLANT y CARNIVORE.
+typedef struct {
+    int filas, columnas;    // Bloques a lo alto (del mundo completo) y a lo ancho
+    int propia0, propia1;   // Filas locales que cuenta este proceso (las fantasmas, su dueño)
+    uint32_t *fila[4];      // Por fila de bloques, agentes en los bloques [0, c] de la fila
+    uint32_t *suma[4];      // Tabla de sumas: agentes en los bloques [0, f) x [0, c), con paso columnas + 1
+    unsigned char *sucia;   // Filas de bloques que cambiaron desde la última tabla
+    int primera;            // Primera fila de bloques de la tabla a rehacer
+} Campo;
+
+// Un arreglo por celda proyectado desde un archivo (ver FUERA DE MEMORIA):
+// sus filas [0, alto) van seguidas a partir de la fila 0
+typedef struct {
+    uint8_t *fila0;         // Fila 0 en la proyección
+    off_t fila0_archivo;    // Posición de la fila 0 en el archivo
+    size_t bytes_fila;
+    int fd;
+} Region;
+
+#define MAX_REGIONES 16     // Dos juegos de planos, las propuestas y las seis máscaras
+#define MAX_ARCHIVOS 4
+#define VENTANA_FRANJAS 4   // En memoria a la vez: anterior, actual, siguiente y la que se escribe
+
+// Rejilla fuera de memoria: los arreglos por celda viven en archivos y las
+// fases los recorren por franjas de filas
+typedef struct {
+    const char *ruta;       // Directorio de los archivos (NULL: todo en memoria)
+    size_t presupuesto;     // Bytes de los arreglos por celda que pueden estar en memoria
+    int filas_franja;       // Múltiplo de TESELA_FILAS
+    int num_franjas;
+    Region region[MAX_REGIONES];
+    int num_regiones;
+    int archivo[MAX_ARCHIVOS];
+    int num_archivos;
+    size_t residente_max;   // Máximo medido al mover la ventana (bytes)
+} Disco;
+
+// Un agente en modo disperso: su celda y los campos que en modo denso viven en
+// los planos
+typedef struct {
+    size_t pos;             // Índice lineal de la celda
+    int8_t energia;
+    uint8_t ticks_sin_comer;
+    uint8_t edad;
+    uint32_t vence;         // Tick al empezar el cual muere (solo animales, ver AGENTES)
+} Agente;
+
+#define SIN_POSICION SIZE_MAX   // Ranura vacía
+#define AGENTES_BLOQUE 1024     // Agentes por unidad de trabajo
+
+// Agentes de una especie. Cada fase deja su salida en "ranuras" (un número
+// fijo por agente: él mismo y sus posibles crías o semillas) y luego se
+// compacta en "a".
+typedef struct {
+    Agente *a;              // Agentes vivos, sin orden particular
+    size_t n;
+    Agente *ranuras;
+    size_t capacidad;       // De "a" y de "ranuras"
+    size_t *bloque;         // Ranuras válidas por bloque y luego su desplazamiento
+    size_t *vencen;         // Ídem para las que vencen en el tick siguiente
+    size_t validos;         // Agentes tras compactar
+    size_t vencidos;        // Los últimos de "a": mueren al empezar la fase de su especie
+} Lista;
+
+// Causas de muerte para las estadísticas
+#define CAUSA_HAMBRE       0   // Sin energía o demasiados ticks sin comer
+#define CAUSA_VEJEZ        1
+#define CAUSA_DEPREDACION  2   // Comido (planta por herbívoro, herbívoro por carnívoro)
+#define CAUSA_SIN_ESPACIO  3   // Planta sin vecinos vacíos
+#define NUM_CAUSAS         4
+
+// Eventos de una fase, por especie. Cada hilo suma en los suyos (alineados a
+// una línea de caché para no compartirla) y se reducen al cerrar la fase.
+typedef struct {
+    _Alignas(64) long nacimientos[4];
+    long muertes[4][NUM_CAUSAS];
+} Contadores;
+
+// Fases que se cronometran (ver BENCHMARK)
+#define FASE_HERBIVOROS          0
+#define FASE_PLANTAS_CARNIVOROS  1
+#define FASE_INTERCAMBIO         2   // Reconciliación de buffers y compactado de listas
+#define FASE_MASCARAS            3   // Máscaras y campo de percepción
+#define FASE_MODO                4   // Elección de representación y conversión
+#define NUM_FASES                5
+
+// Tiempo que un hilo pasó esperando en barreras (en su propia línea de caché)
+typedef struct {
+    _Alignas(64) double segundos;
+} Espera;
+
+#ifdef ECO_INSTRUMENTAR
+// Contadores de la instrumentación (ver INSTRUMENTACIÓN)
+typedef struct {
+    long palabras;          // Palabras de 64 celdas recorridas
+    long agentes;           // Agentes procesados por los núcleos
+    long reclamos;          // Celdas pedidas como destino (movimientos, crías y semillas)
+    long conflictos;        // Reclamos perdidos ante otro agente
+    double espera;          // Segundos en barreras
+} Metricas;
+
+// Un tramo de la traza: una fase de un hilo o una espera en barrera dentro de ella
+typedef struct {
+    int fase;               // FASE_* o -1 si es una barrera
+    long tick;
+    double inicio, fin;
+    Metricas metricas;      // Solo en las fases
+} Tramo;
+
+// Instrumentación de un hilo (en sus propias líneas de caché)
+typedef struct {
+    _Alignas(64) Metricas actual;   // Desde que empezó la fase en curso
+    Metricas total[NUM_FASES];
+    double inicio;          // Comienzo de la fase en curso
+    Tramo *tramos;          // Solo si se pidió la traza
+    size_t num_tramos, capacidad;
+} Instrumento;
+#endif
+
+// Ecosistema de tamaño elegido en tiempo de ejecución. La rejilla vive en el
+// heap (páginas enormes si el sistema las da) y se indexa en orden fila mayor.
+typedef struct {
+    int ancho;
+    int alto;
+    size_t celdas;          // ancho * alto
+    int fila0;              // Fila del mundo completo que es la fila local 0
+    int alto_total;         // Filas del mundo completo (más que alto si está repartido, ver DISTRIBUIDO)
+    Planos ecosistema;      // Estado actual (solo lectura durante una fase)
+    Planos siguiente;       // Estado siguiente; fuera de las fases es igual a "ecosistema"
+    size_t bytes_tick;      // Tráfico de reconciliación acumulado en el tick
+    uint8_t *propuesta;     // Acción que propone cada animal en la fase en curso
+    Mascaras mascaras;      // Clasificación de vecinos del estado actual
+    Teselas teselas;        // Reparto del trabajo por teselas
+    Topologia topologia;
+    Campo campo;            // Solo con radio de percepción
+    Disco disco;            // Solo fuera de memoria
+    const unsigned char *seleccion[2];  // Filas de teselas que visitan las pasadas que proponen [0]
+                                        // y las que aplican [1] (NULL: todas; ver DISTRIBUIDO)
+    uint64_t semilla;       // Clave del generador de números aleatorios
+    long tick;              // Tick en curso (parte del contador del generador)
+    int modo;               // Modo pedido (MODO_AUTO, MODO_DENSO o MODO_DISPERSO)
+    bool disperso;          // Representación en uso: listas de agentes o rejilla
+    bool cambiar_modo;      // Decisión de ajustar_modo, compartida por el equipo
+    bool ordenar_vencidos;  // Listas recién reunidas que aún no apartan a los que vencen
+    Lista agentes[4];       // Listas por especie (sin EMPTY), solo en modo disperso
+    Contadores *contadores; // Uno por hilo
+    int num_contadores;
+    Contadores eventos;     // Eventos del tick en curso (reducidos fase a fase)
+    long poblacion[4];      // Agentes por tipo, al día con los eventos
+    Reglas reglas;
+    bool medir;             // Cronometrar fases y barreras
+    double tiempo_fase[NUM_FASES]; // Segundos acumulados por fase (hilo 0)
+    Espera *espera;         // Uno por hilo
+#ifdef ECO_INSTRUMENTAR
+    Instrumento *instrumento; // Uno por hilo
+    bool trazar;            // Guardar los tramos para la traza
+#endif
+} Mundo;
+
+// Direcciones de la vecindad: las cuatro primeras (N, S, O, E) son la de von
+// Neumann; la de Moore suma las diagonales (NO, NE, SO, SE)
+static const int dx[] = {-1, 1, 0, 0, -1, -1, 1, 1};
+static const int dy[] = {0, 0, -1, 1, -1, 1, -1, 1};
+
+// Índice lineal de la celda (i, j)
+static inline size_t pos(const Mundo *m, int i, int j) {
+    return (size_t) i * m->ancho + j;
+}
+
+// Índice en el mundo completo de la celda local k: es la que alimenta al
+// generador, a la firma y al desempate entre agentes, así un mundo repartido
+// da lo mismo que uno entero. En un toroide repartido las filas fantasma del
+// primer proceso son las últimas del mundo: fila0 está en [0, alto_total) y
+// el índice da la vuelta.
+static inline size_t pos_global(const Mundo *m, size_t k) {
+    size_t total = (size_t) m->alto_total * m->ancho;
+    size_t g = (size_t) m->fila0 * m->ancho + k;
+    return g >= total ? g - total : g;
+}
+
+// Tesela que contiene la celda (i, j)
+static inline int tesela_de(const Mundo *m, int i, int j) {
+    return i / TESELA_FILAS * m->teselas.columnas + j / (64 * TESELA_PALABRAS);
+}
+
+// Rango de filas y palabras que cubre la tesela t
+static inline void limites_tesela(const Mundo *m, int t, int *i0, int *i1, int *k0, int *k1) {
+    const Teselas *ts = &m->teselas;
+    *i0 = (t / ts->columnas) * TESELA_FILAS;
+    *i1 = *i0 + TESELA_FILAS < m->alto ? *i0 + TESELA_FILAS : m->alto;
+    *k0 = (t % ts->columnas) * TESELA_PALABRAS;
+    *k1 = *k0 + TESELA_PALABRAS < m->mascaras.palabras ? *k0 + TESELA_PALABRAS : m->mascaras.palabras;
+}
+
+// Anota que la celda (i, j) de "siguiente" cambió en esta fase. Se lee antes
+// de escribir para no invalidar la línea en los demás hilos si ya estaba
+// anotada.
+static inline void marcar_celda(Mundo *m, int i, int j) {
+    unsigned char *s = &m->teselas.sucia[tesela_de(m, i, j)];
+    if (!__atomic_load_n(s, __ATOMIC_RELAXED)) __atomic_store_n(s, 1, __ATOMIC_RELAXED);
+}
+
+// Anota que la fila local i cambió, para rehacer su fila de bloques del campo
+// de percepción (ver CAMPO)
+static inline void marcar_fila_campo(Mundo *m, int i) {
+    unsigned char *s = &m->campo.sucia[(m->fila0 + i) % m->alto_total / LADO_CAMPO];
+    if (!__atomic_load_n(s, __ATOMIC_RELAXED)) __atomic_store_n(s, 1, __ATOMIC_RELAXED);
+}
+
+// ¿Cambió la tesela t o alguna de sus vecinas? Las derivadas de una celda
+// solo leen sus vecinos inmediatos, que caen en las teselas vecinas según la
+// misma vecindad y topología que las celdas. Fuera del bucle de celdas.
+static bool vecindad_sucia(const Mundo *m, int t) {
+    const Teselas *ts = &m->teselas;
+    const Topologia *tp = &m->topologia;
+    int f = t / ts->columnas, c = t % ts->columnas;
+    if (ts->sucia[t]) return true;
+    for (int d = 0; d < tp->vecinos; d++) {
+        int nf = f + dx[d], nc = c + dy[d];
+        if (nf < 0 || nf >= ts->filas) {
+            if (!tp->envolver_filas) continue;
+            nf = (nf + ts->filas) % ts->filas;
+        }
+        if (nc < 0 || nc >= ts->columnas) {
+            if (!tp->envolver_columnas) continue;
+            nc = (nc + ts->columnas) % ts->columnas;
+        }
+        if (ts->sucia[nf * ts->columnas + nc]) return true;
+    }
+    return false;
+}
+
+// Siguiente tramo de palabras [*k0, *k1) de la fila i que cubren teselas
+// seguidas con marca (sucia o derivar), buscando desde *k1. Devuelve false si
+// no quedan.
+static inline bool siguiente_tramo(const Mundo *m, int i, const unsigned char *marcas, int *k0, int *k1) {
+    const Teselas *ts = &m->teselas;
+    const unsigned char *fila = marcas + i / TESELA_FILAS * ts->columnas;
+    int c = (*k1 + TESELA_PALABRAS - 1) / TESELA_PALABRAS;   // *k1 puede venir recortado a "palabras"
+    while (c < ts->columnas && !fila[c]) c++;
+    if (c == ts->columnas) return false;
+    *k0 = c * TESELA_PALABRAS;
+    while (c < ts->columnas && fila[c]) c++;
+    *k1 = c * TESELA_PALABRAS < m->mascaras.palabras ? c * TESELA_PALABRAS : m->mascaras.palabras;
+    return true;
+}
+
+// Los campos de animales se guardan saturados al rango de su plano
+static inline int saturar(int v, int lo, int hi) {
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+static inline Celda leer_celda(const Planos *pl, size_t k) {
+    return (Celda) {pl->tipo[k], pl->energia[k], pl->ticks_sin_comer[k], pl->edad[k]};
+}
+
+static inline void escribir_celda(Planos *pl, size_t k, Celda c) {
+    pl->tipo[k] = (uint8_t) c.tipo;
+    pl->energia[k] = (int8_t) saturar(c.energia, INT8_MIN, ENERGIA_MAXIMA);
+    pl->ticks_sin_comer[k] = (uint8_t) saturar(c.ticks_sin_comer, 0, UINT8_MAX);
+    pl->edad[k] = (uint8_t) saturar(c.edad, 0, UINT8_MAX);
+}
+
+// Celda vecina de (i, j) en la dirección d; false si cae fuera del mundo. Las
+// tablas de la topología ya resuelven bordes y toroide: no hay comparaciones
+// por coordenada, solo una por vecino.
+static inline bool vecino(const Mundo *m, int i, int j, int d, int *ni, int *nj) {
+    *ni = m->topologia.fila[dx[d] + 1][i];
+    *nj = m->topologia.columna[dy[d] + 1][j];
+    return (*ni | *nj) >= 0;
+}
+
+// -------------------------------- AZAR --------------------------------
+//
+// Generador Philox4x32-10 basado en contador: el número aleatorio es una
+// función pura de (semilla, tick, celda, flujo), sin estado compartido entre
+// hilos. Cada celda obtiene los mismos valores sin importar qué hilo la
+// procese ni en qué orden, así que una semilla reproduce la corrida exacta
+// con cualquier número de hilos.
+
+#define FLUJO_SIEMBRA           1   // Colonización de plantas
+#define FLUJO_INICIO            2   // Colocación inicial
+#define FLUJO_SIEMBRA_DIAGONAL  3   // Colonización por las diagonales (vecindad de Moore)
+#define FLUJO_REPARTO           4   // Agentes iniciales de cada bloque de filas
+#define FLUJO_GRUMOS            5   // Manchas de la distribución de grumos
+
+typedef struct {
+    uint32_t v[4];
+} Aleatorio;
+
+static inline Aleatorio philox(uint64_t semilla, uint64_t celda, uint32_t tick, uint32_t flujo) {
+    uint32_t x0 = (uint32_t) celda, x1 = (uint32_t) (celda >> 32), x2 = tick, x3 = flujo;
+    uint32_t k0 = (uint32_t) semilla, k1 = (uint32_t) (semilla >> 32);
+
+    for (int r = 0; r < 10; r++) {
+        uint64_t p0 = (uint64_t) 0xD2511F53u * x0;
+        uint64_t p1 = (uint64_t) 0xCD9E8D57u * x2;
+        x0 = (uint32_t) (p1 >> 32) ^ x1 ^ k0;
+        x1 = (uint32_t) p1;
+        x2 = (uint32_t) (p0 >> 32) ^ x3 ^ k1;
+        x3 = (uint32_t) p0;
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+    return (Aleatorio) {{x0, x1, x2, x3}};
+}
+
+// Entero uniforme en [0, n) a partir de 32 bits aleatorios (multiplicación, sin módulo)
+static inline uint32_t en_rango(uint32_t r, uint32_t n) {
+    return (uint32_t) (((uint64_t) r * n) >> 32);
+}
+
+// Umbral de 32 bits equivalente a "rand() % 100 < pct"
+#define UMBRAL_PCT(pct) ((uint32_t) (((uint64_t) (pct) << 32) / 100))
+
+// ------------------------------ TOPOLOGÍA ------------------------------
+//
+// El mundo puede tener bordes (acotado) o ser un toroide, con vecindad de 4
+// (von Neumann) u 8 celdas (Moore). Nada de esto se compara en los bucles
+// internos: las máscaras del modo denso llevan filas y palabras fantasma que,
+// en un toroide, guardan la fila o la columna del otro lado (ver
+// actualizar_mascaras), y los recorridos celda a celda leen la coordenada
+// vecina de una tabla por dirección que ya viene envuelta o marcada como
+// fuera del mundo (ver vecino).
+
+static int reservar_topologia(Topologia *tp, int ancho, int alto) {
+    int *bloque = malloc((size_t) 3 * (alto + ancho) * sizeof(int));
+    if (bloque == NULL) return -1;
+    for (int d = 0; d < 3; d++) {
+        tp->fila[d] = bloque + (size_t) d * alto;
+        tp->columna[d] = bloque + (size_t) 3 * alto + (size_t) d * ancho;
+    }
+    return 0;
+}
+
+static void liberar_topologia(Topologia *tp) {
+    free(tp->fila[0]);
+    tp->fila[0] = NULL;
+}
+
+// Coordenada vecina de x a distancia d (-1, 0 o 1) en un eje de n celdas
+static int envolver(int x, int d, int n, bool toroide) {
+    int v = x + d;
+    return v >= 0 && v < n ? v : toroide ? (v + n) % n : -1;
+}
+
+// Fija la topología de un mundo recién creado (antes de construir las máscaras)
+void fijar_topologia(Mundo *m, bool envolver_filas, bool envolver_columnas, int vecinos) {
+    Topologia *tp = &m->topologia;
+    tp->vecinos = vecinos;
+    tp->envolver_filas = envolver_filas;
+    tp->envolver_columnas = envolver_columnas;
+    for (int d = -1; d <= 1; d++) {
+        for (int i = 0; i < m->alto; i++) tp->fila[d + 1][i] = envolver(i, d, m->alto, envolver_filas);
+        for (int j = 0; j < m->ancho; j++) tp->columna[d + 1][j] = envolver(j, d, m->ancho, envolver_columnas);
+    }
+    // Con bordes la palabra fantasma de la derecha está en cero y da igual
+    m->mascaras.corrimiento = envolver_columnas ? (m->ancho - 1) % 64 : 63;
+}
+
+// ------------------------------- MEMORIA -------------------------------
+
+#define PAGINA_ENORME (2u << 20)
+
+static size_t redondear_pagina(size_t bytes) {
+    return (bytes + PAGINA_ENORME - 1) & ~((size_t) PAGINA_ENORME - 1);
+}
+
+// Reserva memoria para rejillas grandes. En Linux intenta primero páginas
+// enormes explícitas (MAP_HUGETLB) y si no hay reservadas usa páginas normales
+// pidiendo THP. La memoria devuelta ya viene en cero.
+void *reservar_memoria(size_t bytes) {
+#ifdef __linux__
+    size_t total = redondear_pagina(bytes);
+    void *p = mmap(NULL, total, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) return p;
+
+    p = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    madvise(p, total, MADV_HUGEPAGE);
+    return p;
+#else
+    return calloc(1, bytes);
+#endif
+}
+
+void liberar_memoria(void *p, size_t bytes) {
+    if (p == NULL) return;
+#ifdef __linux__
+    munmap(p, redondear_pagina(bytes));
+#else
+    (void) bytes;
+    free(p);
+#endif
+}
+
+// Como reservar_memoria, pero en un archivo sin nombre dentro del directorio
+// de "d", proyectado compartido: el kernel escribe y desaloja sus páginas en
+// vez de necesitar RAM o swap. El espacio se reserva en el disco de entrada,
+// así quedarse sin lugar es un error al crear y no a mitad de la corrida.
+static void *reservar_en_disco(Disco *d, size_t bytes) {
+    if (d->num_archivos == MAX_ARCHIVOS) return NULL;
+    size_t total = redondear_pagina(bytes);
+    size_t largo = strlen(d->ruta) + sizeof("/ecoXXXXXX");
+    char *nombre = malloc(largo);
+    if (nombre == NULL) return NULL;
+    snprintf(nombre, largo, "%s/ecoXXXXXX", d->ruta);
+    int fd = mkstemp(nombre);
+    if (fd >= 0) unlink(nombre);
+    free(nombre);
+    if (fd < 0) return NULL;
+
+    void *p = posix_fallocate(fd, 0, (off_t) total) == 0
+        ? mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (p == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    d->archivo[d->num_archivos++] = fd;
+    return p;
+}
+
+// Arreglo por celda de "planos" planos de "bytes_plano" bytes, cuya fila 0
+// está "fila0" bytes después del comienzo de cada plano. Fuera de memoria va
+// a un archivo y cada plano queda anotado como región para las franjas.
+static void *reservar_arreglo(Disco *d, size_t bytes, int planos, size_t bytes_plano, size_t fila0,
+                              size_t bytes_fila) {
+    if (d == NULL || d->ruta == NULL) return reservar_memoria(bytes);
+    if (d->num_regiones + planos > MAX_REGIONES) return NULL;
+    uint8_t *p = reservar_en_disco(d, bytes);
+    if (p == NULL) return NULL;
+    for (int q = 0; q < planos; q++) {
+        size_t desp = q * bytes_plano + fila0;
+        d->region[d->num_regiones++] = (Region) {p + desp, (off_t) desp, bytes_fila, d->archivo[d->num_archivos - 1]};
+    }
+    return p;
+}
+
+// Cierra los archivos de la rejilla fuera de memoria (las proyecciones se
+// liberan con cada arreglo)
+static void liberar_disco(Disco *d) {
+    for (int a = 0; a < d->num_archivos; a++) close(d->archivo[a]);
+    d->num_archivos = d->num_regiones = 0;
+}
+
+// Reparte un bloque de BYTES_CELDA * celdas bytes entre los cuatro planos
+// (con "d", fuera de memoria)
+static int reservar_planos(Planos *pl, int ancho, size_t celdas, Disco *d) {
+    uint8_t *bloque = reservar_arreglo(d, celdas * BYTES_CELDA, BYTES_CELDA, celdas, 0, ancho);
+    if (bloque == NULL) return -1;
+    pl->tipo = bloque;
+    pl->energia = (int8_t *) (bloque + celdas);
+    pl->ticks_sin_comer = bloque + 2 * celdas;
+    pl->edad = bloque + 3 * celdas;
+    return 0;
+}
+
+static void liberar_planos(Planos *pl, size_t celdas) {
+    liberar_memoria(pl->tipo, celdas * BYTES_CELDA);
+    pl->tipo = NULL;
+}
+
+// Cada máscara ocupa (alto + 2) filas de "paso" palabras, todas en cero
+static size_t bytes_mascara(const Mascaras *mk, int alto) {
+    return (size_t) (alto + 2) * mk->paso * sizeof(uint64_t);
+}
+
+static int reservar_mascaras(Mascaras *mk, int ancho, int alto, Disco *d) {
+    mk->palabras = (ancho + 63) / 64;
+    mk->paso = mk->palabras + 2;
+    size_t bytes = bytes_mascara(mk, alto);
+    size_t fila = mk->paso * sizeof(uint64_t);
+    uint64_t *bloque = reservar_arreglo(d, 6 * bytes, 6, bytes, fila, fila);
+    if (bloque == NULL) return -1;
+
+    size_t n = bytes / sizeof(uint64_t);
+    for (int t = 0; t < 4; t++) mk->tipo[t] = bloque + t * n;
+    mk->seguro = bloque + 4 * n;
+    mk->cerca_planta = bloque + 5 * n;
+    return 0;
+}
+
+static void liberar_mascaras(Mascaras *mk, int alto) {
+    if (mk->tipo[0] == NULL) return;
+    liberar_memoria(mk->tipo[0], 6 * bytes_mascara(mk, alto));
+    mk->tipo[0] = NULL;
+}
+
+static int reservar_teselas(Teselas *ts, int ancho, int alto) {
+    ts->filas = (alto + TESELA_FILAS - 1) / TESELA_FILAS;
+    ts->columnas = ((ancho + 63) / 64 + TESELA_PALABRAS - 1) / TESELA_PALABRAS;
+    ts->total = ts->filas * ts->columnas;
+    ts->conteo[EMPTY] = ts->activas[EMPTY] = NULL;
+    ts->num_activas[EMPTY] = 0;
+
+    uint32_t *bloque = calloc((size_t) 6 * ts->total, sizeof(uint32_t));
+    ts->sucia = calloc(2 * (size_t) ts->total, 1);
+    ts->derivar = ts->sucia + ts->total;
+    if (bloque == NULL || ts->sucia == NULL) {
+        free(bloque);
+        free(ts->sucia);
+        ts->sucia = NULL;
+        return -1;
+    }
+    for (int t = PLANT; t <= CARNIVORE; t++) {
+        ts->conteo[t] = bloque + (size_t) (2 * (t - 1)) * ts->total;
+        ts->activas[t] = bloque + (size_t) (2 * (t - 1) + 1) * ts->total;
+        ts->num_activas[t] = 0;
+    }
+    return 0;
+}
+
+static void liberar_teselas(Teselas *ts) {
+    free(ts->conteo[PLANT]);
+    free(ts->sucia);
+    ts->conteo[PLANT] = NULL;
+    ts->sucia = NULL;
+}
+
+// Las dos filas de prefijos y las dos tablas de sumas (plantas y carnívoros)
+// y las marcas por fila de bloques
+static size_t bytes_campo(const Campo *c) {
+    size_t n = (size_t) c->filas * c->columnas + (size_t) (c->filas + 1) * (c->columnas + 1);
+    return 2 * n * sizeof(uint32_t) + c->filas;
+}
+
+// Campo de un mundo de ancho x alto (el mundo completo, aunque este proceso
+// tenga menos filas). Sin radio de percepción nunca se toca, así que las
+// páginas del mmap ni se llegan a asignar.
+static int reservar_campo(Campo *c, int ancho, int alto) {
+    c->filas = (alto + LADO_CAMPO - 1) / LADO_CAMPO;
+    c->columnas = (ancho + LADO_CAMPO - 1) / LADO_CAMPO;
+    c->propia0 = 0;
+    c->propia1 = alto;
+    c->primera = 0;
+    uint32_t *bloque = reservar_memoria(bytes_campo(c));
+    if (bloque == NULL) return -1;
+    size_t n = (size_t) c->filas * c->columnas;
+    c->fila[EMPTY] = c->fila[HERBIVORE] = c->suma[EMPTY] = c->suma[HERBIVORE] = NULL;
+    c->fila[PLANT] = bloque;
+    c->fila[CARNIVORE] = bloque + n;
+    c->suma[PLANT] = bloque + 2 * n;
+    c->suma[CARNIVORE] = c->suma[PLANT] + (size_t) (c->filas + 1) * (c->columnas + 1);
+    c->sucia = (unsigned char *) (c->suma[CARNIVORE] + (size_t) (c->filas + 1) * (c->columnas + 1));
+    return 0;
+}
+
+static void liberar_campo(Campo *c) {
+    if (c->fila[PLANT] == NULL) return;
+    liberar_memoria(c->fila[PLANT], bytes_campo(c));
+    c->fila[PLANT] = NULL;
+}
+
+// Asegura capacidad para "necesarias" ranuras. Los agentes vivos se conservan;
+// el arreglo de bloques también alcanza para una entrada por tesela, que usa
+// el paso de la rejilla a listas.
+static int reservar_lista(Lista *l, size_t necesarias, int teselas) {
+    if (l->bloque != NULL && necesarias <= l->capacidad) return 0;
+    size_t capacidad = 2 * necesarias + AGENTES_BLOQUE;
+
+    Agente *a = realloc(l->a, capacidad * sizeof(Agente));
+    if (a == NULL) return -1;
+    l->a = a;
+    free(l->ranuras);
+    free(l->bloque);
+    free(l->vencen);
+    l->ranuras = malloc(capacidad * sizeof(Agente));
+    l->bloque = malloc((capacidad / AGENTES_BLOQUE + 1 + teselas) * sizeof(size_t));
+    l->vencen = malloc((capacidad / AGENTES_BLOQUE + 1) * sizeof(size_t));
+    if (l->ranuras == NULL || l->bloque == NULL || l->vencen == NULL) {
+        free(l->ranuras);
+        free(l->bloque);
+        free(l->vencen);
+        l->ranuras = NULL;
+        l->bloque = NULL;
+        l->vencen = NULL;
+        l->capacidad = 0;
+        return -1;
+    }
+    l->capacidad = capacidad;
+    return 0;
+}
+
+static void liberar_lista(Lista *l) {
+    free(l->a);
+    free(l->ranuras);
+    free(l->bloque);
+    free(l->vencen);
+    *l = (Lista) {0};
+}
+
+// Filas por franja para que VENTANA_FRANJAS franjas de los arreglos por celda
+// quepan en el presupuesto (al menos una fila de teselas, a lo sumo el mundo)
+static int filas_franja(int ancho, int alto, size_t presupuesto) {
+    size_t paso = (size_t) (ancho + 63) / 64 + 2;
+    size_t bytes_fila = (size_t) 2 * BYTES_CELDA * ancho + ancho + 6 * paso * sizeof(uint64_t);
+    size_t filas = presupuesto / (VENTANA_FRANJAS * bytes_fila) / TESELA_FILAS * TESELA_FILAS;
+    if (filas < TESELA_FILAS) {
+        fprintf(stderr, "Presupuesto menor que %zu MB: se usan franjas de %d filas\n",
+                (VENTANA_FRANJAS * TESELA_FILAS * bytes_fila + (1u << 20) - 1) >> 20, TESELA_FILAS);
+        filas = TESELA_FILAS;
+    }
+    return filas < (size_t) alto ? (int) filas : alto;
+}
+
+// Reserva los dos buffers y el plano de propuestas de un mundo ancho x alto.
+// Con "disco", los arreglos por celda van a archivos en ese directorio y las
+// fases los recorren por franjas que quepan en "presupuesto" bytes.
+int crear_mundo(Mundo *m, int ancho, int alto, const char *disco, size_t presupuesto) {
+    m->ancho = ancho;
+    m->alto = alto;
+    m->celdas = (size_t) ancho * alto;
+    m->fila0 = 0;
+    m->alto_total = alto;
+    m->modo = MODO_AUTO;
+    m->disperso = false;
+    m->cambiar_modo = false;
+    for (int e = 0; e < 4; e++) m->agentes[e] = (Lista) {0};
+    m->eventos = (Contadores) {0};
+    memset(m->poblacion, 0, sizeof(m->poblacion));
+    m->num_contadores = omp_get_max_threads();
+    m->contadores = aligned_alloc(_Alignof(Contadores), m->num_contadores * sizeof(Contadores));
+    if (m->contadores != NULL) memset(m->contadores, 0, m->num_contadores * sizeof(Contadores));
+    m->reglas = REGLAS_BASE;
+    m->medir = false;
+    memset(m->tiempo_fase, 0, sizeof(m->tiempo_fase));
+    m->espera = aligned_alloc(_Alignof(Espera), m->num_contadores * sizeof(Espera));
+    if (m->espera != NULL) memset(m->espera, 0, m->num_contadores * sizeof(Espera));
+    m->disco = (Disco) {.ruta = disco, .presupuesto = presupuesto, .filas_franja = alto, .num_franjas = 1};
+    if (disco != NULL) {
+        m->disco.filas_franja = filas_franja(ancho, alto, presupuesto);
+        m->disco.num_franjas = (int) (((long) alto + m->disco.filas_franja - 1) / m->disco.filas_franja);
+    }
+    m->ecosistema.tipo = m->siguiente.tipo = NULL;
+    int r = reservar_planos(&m->ecosistema, ancho, m->celdas, &m->disco);
+    r |= reservar_planos(&m->siguiente, ancho, m->celdas, &m->disco);
+    m->bytes_tick = 0;
+    m->propuesta = reservar_arreglo(&m->disco, m->celdas, 1, m->celdas, 0, ancho);
+    m->mascaras.tipo[0] = NULL;
+    r |= reservar_mascaras(&m->mascaras, ancho, alto, &m->disco);
+    m->teselas.conteo[PLANT] = NULL;
+    r |= reservar_teselas(&m->teselas, ancho, alto);
+    m->teselas.en_orden = disco != NULL;
+    m->seleccion[0] = m->seleccion[1] = NULL;
+    m->topologia.fila[0] = NULL;
+    r |= reservar_topologia(&m->topologia, ancho, alto);
+    m->campo.fila[PLANT] = NULL;
+    r |= reservar_campo(&m->campo, ancho, alto);
+#ifdef ECO_INSTRUMENTAR
+    m->trazar = false;
+    m->instrumento = aligned_alloc(_Alignof(Instrumento), m->num_contadores * sizeof(Instrumento));
+    if (m->instrumento != NULL) memset(m->instrumento, 0, m->num_contadores * sizeof(Instrumento));
+    else r = -1;
+#endif
+    if (r != 0 || m->propuesta == NULL || m->contadores == NULL || m->espera == NULL) {
+        liberar_planos(&m->ecosistema, m->celdas);
+        liberar_planos(&m->siguiente, m->celdas);
+        liberar_memoria(m->propuesta, m->celdas);
+        liberar_mascaras(&m->mascaras, alto);
+        liberar_teselas(&m->teselas);
+        liberar_topologia(&m->topologia);
+        liberar_campo(&m->campo);
+        liberar_disco(&m->disco);
+        free(m->contadores);
+        free(m->espera);
+#ifdef ECO_INSTRUMENTAR
+        free(m->instrumento);
+#endif
+        return -1;
+    }
+    fijar_topologia(m, false, false, 4);
+    return 0;
+}
+
+void destruir_mundo(Mundo *m) {
+    liberar_planos(&m->ecosistema, m->celdas);
+    liberar_planos(&m->siguiente, m->celdas);
+    liberar_memoria(m->propuesta, m->celdas);
+    liberar_mascaras(&m->mascaras, m->alto);
+    liberar_teselas(&m->teselas);
+    liberar_topologia(&m->topologia);
+    liberar_campo(&m->campo);
+    liberar_disco(&m->disco);
+    for (int e = PLANT; e <= CARNIVORE; e++) liberar_lista(&m->agentes[e]);
+    free(m->contadores);
+    free(m->espera);
+#ifdef ECO_INSTRUMENTAR
+    for (int h = 0; h < m->num_contadores; h++) free(m->instrumento[h].tramos);
+    free(m->instrumento);
+#endif
+    m->propuesta = NULL;
+}
+
+// Contadores del hilo que llama (dentro del equipo)
+static inline Contadores *contadores_hilo(Mundo *m) {
+    return &m->contadores[omp_get_thread_num()];
+}
+
+// Instrumentación de los núcleos: compilada solo con -DECO_INSTRUMENTAR (ver
+// INSTRUMENTACIÓN); sin ella, los contadores y tramos no dejan ni una
+// instrucción en el camino caliente.
+#ifdef ECO_INSTRUMENTAR
+#define INSTRUMENTAR(m, campo, n) ((m)->instrumento[omp_get_thread_num()].actual.campo += (n))
+
+static void agregar_tramo(Instrumento *in, Tramo t) {
+    if (in->num_tramos == in->capacidad) {
+        size_t capacidad = in->capacidad ? 2 * in->capacidad : 4096;
+        Tramo *tramos = realloc(in->tramos, capacidad * sizeof(Tramo));
+        if (tramos == NULL) return;     // La traza queda corta, la corrida sigue
+        in->tramos = tramos;
+        in->capacidad = capacidad;
+    }
+    in->tramos[in->num_tramos++] = t;
+}
+
+// Empieza la primera fase del tick en el hilo que llama (lo hecho entre
+// ticks, como los cuadros de salida, no cuenta)
+static inline void abrir_tramo(Mundo *m) {
+    Instrumento *in = &m->instrumento[omp_get_thread_num()];
+    in->actual = (Metricas) {0};
+    in->inicio = omp_get_wtime();
+}
+
+// Cierra la fase "fase" en el hilo que llama: sus contadores pasan al total de
+// la fase (y a la traza) y empieza la siguiente
+static inline void cerrar_tramo(Mundo *m, int fase) {
+    Instrumento *in = &m->instrumento[omp_get_thread_num()];
+    double ahora = omp_get_wtime();
+    Metricas *a = &in->actual, *t = &in->total[fase];
+    t->palabras += a->palabras;
+    t->agentes += a->agentes;
+    t->reclamos += a->reclamos;
+    t->conflictos += a->conflictos;
+    t->espera += a->espera;
+    if (m->trazar) agregar_tramo(in, (Tramo) {fase, m->tick, in->inicio, ahora, *a});
+    *a = (Metricas) {0};
+    in->inicio = ahora;
+}
+
+static inline void anotar_barrera(Mundo *m, double t0, double t1) {
+    Instrumento *in = &m->instrumento[omp_get_thread_num()];
+    in->actual.espera += t1 - t0;
+    if (m->trazar) agregar_tramo(in, (Tramo) {-1, m->tick, t0, t1, {0}});
+}
+#else
+#define INSTRUMENTAR(m, campo, n) ((void) 0)
+
+static inline void abrir_tramo(Mundo *m) { (void) m; }
+static inline void cerrar_tramo(Mundo *m, int fase) { (void) m; (void) fase; }
+#endif
+
+// Barrera del equipo. Al medir, suma lo que este hilo esperó en ella: es el
+// costo de sincronización y de desbalance (no hay locks que esperar).
+static inline void barrera(Mundo *m) {
+#ifndef ECO_INSTRUMENTAR
+    if (!m->medir) {
+        #pragma omp barrier
+        return;
+    }
+#endif
+    double t0 = omp_get_wtime();
+    #pragma omp barrier
+    double t1 = omp_get_wtime();
+    m->espera[omp_get_thread_num()].segundos += t1 - t0;
+#ifdef ECO_INSTRUMENTAR
+    anotar_barrera(m, t0, t1);
+#endif
+}
+
+// Suma los contadores de los hilos a los eventos del tick, pone al día la
+// población y los deja en cero. La llama un solo hilo al cerrar cada fase.
+static void reducir_contadores(Mundo *m) {
+    for (int h = 0; h < m->num_contadores; h++) {
+        Contadores *c = &m->contadores[h];
+        for (int e = PLANT; e <= CARNIVORE; e++) {
+            m->eventos.nacimientos[e] += c->nacimientos[e];
+            m->poblacion[e] += c->nacimientos[e];
+            for (int causa = 0; causa < NUM_CAUSAS; causa++) {
+                m->eventos.muertes[e][causa] += c->muertes[e][causa];
+                m->poblacion[e] -= c->muertes[e][causa];
+            }
+        }
+        *c = (Contadores) {0};
+    }
+    m->poblacion[EMPTY] = (long) m->celdas - m->poblacion[PLANT] - m->poblacion[HERBIVORE] - m->poblacion[CARNIVORE];
+}
+
+// Cuenta la población recorriendo la rejilla; solo hace falta al crear o
+// restaurar el mundo, después se sigue con los eventos
+void recontar_poblacion(Mundo *m) {
+    long plantas = 0, herbivoros = 0, carnivoros = 0;
+    #pragma omp parallel for schedule(static) reduction(+:plantas, herbivoros, carnivoros)
+    for (size_t k = 0; k < m->celdas; k++) {
+        plantas += m->ecosistema.tipo[k] == PLANT;
+        herbivoros += m->ecosistema.tipo[k] == HERBIVORE;
+        carnivoros += m->ecosistema.tipo[k] == CARNIVORE;
+    }
+    m->poblacion[PLANT] = plantas;
+    m->poblacion[HERBIVORE] = herbivoros;
+    m->poblacion[CARNIVORE] = carnivoros;
+    m->poblacion[EMPTY] = (long) m->celdas - plantas - herbivoros - carnivoros;
+}
+
+// -------------------------- FUERA DE MEMORIA --------------------------
+//
+// Con --disco, los arreglos por celda (los dos juegos de planos, las
+// propuestas y las máscaras, casi toda la memoria de un mundo denso) se
+// proyectan desde archivos en vez de pedirse anónimos, así el kernel puede
+// escribir y desalojar sus páginas y el mundo puede ser más grande que la
+// RAM. Para que lo residente no dependa del kernel, las pasadas del tick
+// recorren el mundo por franjas de filas, en orden, y al cerrar cada franja
+// un hilo mueve la ventana mientras el resto sigue con la siguiente: pide por
+// adelantado la franja que viene (MADV_WILLNEED), suelta la anterior
+// (MADV_DONTNEED) y empieza a escribirla (sync_file_range), y saca de la
+// caché de páginas la de antes, que ya terminó de escribirse. Así hay a lo
+// sumo VENTANA_FRANJAS franjas en memoria, y el tamaño de franja sale del
+// presupuesto. Una franja lee y escribe dos filas más allá de cada borde, que
+// están en las franjas vecinas todavía en memoria (o, en un toroide, vuelven
+// a leerse del archivo). Las teselas activas se ordenan por posición y no por
+// población, para recorrerlas franja a franja; el resultado no depende del
+// orden, así que la firma es la misma que en memoria. Las pasadas fuera del
+// tick (población inicial, firma) dejan que el kernel desaloje, y solo hay
+// modo denso.
+
+// Memoria residente del proceso en bytes (0 si no se puede leer)
+static size_t memoria_residente(void) {
+    long paginas = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL) return 0;
+    if (fscanf(f, "%*s %ld", &paginas) != 1) paginas = 0;
+    fclose(f);
+    return (size_t) paginas * (size_t) sysconf(_SC_PAGESIZE);
+}
+
+// Bytes de las filas [i0, i1) de la región r, extendidos a páginas completas
+static void tramo_filas(const Region *r, long i0, long i1, uint8_t **p, off_t *desp, size_t *largo) {
+    size_t pagina = (size_t) sysconf(_SC_PAGESIZE);
+    uintptr_t inicio = (uintptr_t) (r->fila0 + i0 * r->bytes_fila) & ~(uintptr_t) (pagina - 1);
+    uintptr_t fin = (uintptr_t) (r->fila0 + i1 * r->bytes_fila);
+    *p = (uint8_t *) inicio;
+    *desp = r->fila0_archivo - (off_t) ((uintptr_t) r->fila0 - inicio);
+    *largo = fin - inicio;
+}
+
+static void tramo_franja(const Mundo *m, const Region *r, int f, uint8_t **p, off_t *desp, size_t *largo) {
+    long i0 = (long) f * m->disco.filas_franja;
+    long i1 = i0 + m->disco.filas_franja < m->alto ? i0 + m->disco.filas_franja : m->alto;
+    tramo_filas(r, i0, i1, p, desp, largo);
+}
+
+// Saca "vieja" de la caché de páginas (esperando a que termine de
+// escribirse), suelta "anterior" y empieza a escribirla, y pide "siguiente"
+static void mover_ventana(Mundo *m, int siguiente, int anterior, int vieja) {
+    Disco *d = &m->disco;
+    for (int q = 0; q < d->num_regiones; q++) {
+        const Region *r = &d->region[q];
+        uint8_t *p;
+        off_t desp;
+        size_t largo;
+        tramo_franja(m, r, vieja, &p, &desp, &largo);
+        sync_file_range(r->fd, desp, (off_t) largo,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(r->fd, desp, (off_t) largo, POSIX_FADV_DONTNEED);
+        tramo_franja(m, r, anterior, &p, &desp, &largo);
+        madvise(p, largo, MADV_DONTNEED);
+        sync_file_range(r->fd, desp, (off_t) largo, SYNC_FILE_RANGE_WRITE);
+        tramo_franja(m, r, siguiente, &p, &desp, &largo);
+        madvise(p, largo, MADV_WILLNEED);
+    }
+    size_t residente = memoria_residente();
+    if (residente > d->residente_max) d->residente_max = residente;
+}
+
+// Filas [i0, i1) de la franja f; false cuando no quedan. En memoria hay una
+// sola franja con todo el mundo.
+static inline bool franja(const Mundo *m, int f, int *i0, int *i1) {
+    if (f >= m->disco.num_franjas) return false;
+    *i0 = f * m->disco.filas_franja;
+    *i1 = m->alto - *i0 > m->disco.filas_franja ? *i0 + m->disco.filas_franja : m->alto;
+    return true;
+}
+
+// Cierra la franja f de una pasada. Fuera de memoria espera al equipo y un
+// hilo mueve la ventana mientras los demás siguen: la franja f + 1 ya se pidió
+// al cerrar la anterior, así que se pide la f + 2. Las franjas dan la vuelta:
+// tras la última viene la primera de la pasada siguiente. En memoria no hace
+// nada. Lo deben llamar todos los hilos del equipo.
+static inline void pasar_franja(Mundo *m, int f) {
+    int n = m->disco.num_franjas;
+    if (m->disco.ruta == NULL) return;
+    barrera(m);
+    if (n <= VENTANA_FRANJAS) return;   // Todo el mundo cabe en el presupuesto
+    #pragma omp single nowait
+    mover_ventana(m, (f + 2) % n, (f + n - 1) % n, (f + n - 2) % n);
+}
+
+// Escribe y suelta toda la rejilla fuera de memoria, para empezar los ticks
+// con la ventana vacía tras una pasada completa (población inicial o checkpoint)
+void soltar_disco(Mundo *m) {
+    Disco *d = &m->disco;
+    for (int q = 0; q < d->num_regiones; q++) {
+        const Region *r = &d->region[q];
+        uint8_t *p;
+        off_t desp;
+        size_t largo;
+        tramo_filas(r, 0, m->alto, &p, &desp, &largo);
+        msync(p, largo, MS_SYNC);
+        madvise(p, largo, MADV_DONTNEED);
+        posix_fadvise(r->fd, desp, (off_t) largo, POSIX_FADV_DONTNEED);
+    }
+    d->residente_max = memoria_residente();
+}
+
+// Cierra una fase: "siguiente" pasa a ser el estado actual intercambiando
+// punteros, y el buffer viejo se pone al día copiando solo las teselas que la
+// fase modificó. Las marcas quedan para actualizar_mascaras, que las limpia.
+// Lo deben llamar todos los hilos del equipo.
+void intercambiar_buffers(Mundo *m) {
+    #pragma omp single
+    {
+        reducir_contadores(m);
+        Planos tmp = m->ecosistema;
+        m->ecosistema = m->siguiente;
+        m->siguiente = tmp;
+    }
+
+    // Por filas, copiando de una vez cada tramo de teselas marcadas seguidas:
+    // si la fase tocó todo, son las mismas copias de fila entera de siempre
+    size_t copiados = 0;
+    for (int f = 0, f0, f1; franja(m, f, &f0, &f1); f++) {
+        #pragma omp for schedule(static) nowait
+        for (int i = f0; i < f1; i++) {
+            for (int k0, k1 = 0; siguiente_tramo(m, i, m->teselas.sucia, &k0, &k1);) {
+                int j0 = 64 * k0;
+                int j1 = 64 * k1 < m->ancho ? 64 * k1 : m->ancho;
+                size_t k = pos(m, i, j0);
+                for (int p = 0; p < BYTES_CELDA; p++)
+                    memcpy(m->siguiente.tipo + p * m->celdas + k, m->ecosistema.tipo + p * m->celdas + k, j1 - j0);
+                copiados += (size_t) (j1 - j0) * BYTES_CELDA;
+            }
+        }
+        pasar_franja(m, f);
+    }
+
+    #pragma omp atomic
+    m->bytes_tick += copiados;
+    barrera(m);
+}
+
+// Texto del resumen de poblaciones (cuenta indexada por tipo) en "out"
+static size_t texto_resumen(char *out, size_t cap, const long cuenta[4]) {
+    int n = snprintf(out, cap,
+                     "\nResumen:\n"
+                     "Plantas:     %ld\n"
+                     "Herbívoros:  %ld\n"
+                     "Carnívoros:  %ld\n"
+                     "Vacíos:      %ld\n",
+                     cuenta[PLANT], cuenta[HERBIVORE], cuenta[CARNIVORE], cuenta[EMPTY]);
+    return n < 0 ? 0 : (size_t) n < cap ? (size_t) n : cap - 1;
+}
+
+// Imprimir tamaño de cada población
+void imprimir_resumen(const Mundo *m) {
+    char texto[256];
+    texto_resumen(texto, sizeof(texto), m->poblacion);
+    fputs(texto, stdout);
+}
+
+// Hash de una celda ocupada para la firma
+static inline uint64_t hash_celda(size_t k, int tipo, int8_t energia, uint8_t ticks_sin_comer, uint8_t edad) {
+    uint64_t h = k * 0x9E3779B97F4A7C15ull
+               ^ (uint64_t) tipo << 56
+               ^ (uint64_t) (uint8_t) energia << 48
+               ^ (uint64_t) ticks_sin_comer << 40
+               ^ (uint64_t) edad << 32;
+    h ^= h >> 30; h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27; h *= 0x94D049BB133111EBull;
+    h ^= h >> 31;
+    return h;
+}
+
+// Firma de las filas locales [i0, i1) de la rejilla
+static uint64_t firma_filas(const Mundo *m, int i0, int i1) {
+    const Planos *eco = &m->ecosistema;
+    uint64_t firma = 0;
+    #pragma omp parallel for schedule(static) reduction(+:firma)
+    for (size_t k = pos(m, i0, 0); k < pos(m, i1, 0); k++) {
+        if (eco->tipo[k] == EMPTY) continue;
+        firma += hash_celda(pos_global(m, k), eco->tipo[k], eco->energia[k], eco->ticks_sin_comer[k], eco->edad[k]);
+    }
+    return firma;
+}
+
+// Resumen de 64 bits del estado completo. Es una suma de hashes por celda, así
+// que no depende del orden de recorrido y se calcula en paralelo; dos corridas
+// con la misma semilla deben dar la misma firma con cualquier número de hilos
+// y en cualquiera de los dos modos.
+uint64_t firma_ecosistema(const Mundo *m) {
+    if (!m->disperso) return firma_filas(m, 0, m->alto);
+
+    uint64_t firma = 0;
+    for (int e = PLANT; e <= CARNIVORE; e++) {
+        const Lista *l = &m->agentes[e];
+        #pragma omp parallel for schedule(static) reduction(+:firma)
+        for (size_t n = 0; n < l->n; n++) {
+            const Agente *a = &l->a[n];
+            firma += hash_celda(pos_global(m, a->pos), e, a->energia, a->ticks_sin_comer, a->edad);
+        }
+    }
+    return firma;
+}
+
+// Bytes copiados para reconciliar buffers en el tick, comparados con las seis
+// copias completas de la rejilla que hacía el esquema de copias por fase
+static size_t texto_trafico(char *out, size_t cap, const Mundo *m) {
+    double completo = 6.0 * m->celdas * BYTES_CELDA;
+    int n = snprintf(out, cap, "Tráfico de memoria: %.1f KiB (copias completas: %.1f KiB, %.1f%%)\n",
+                     m->bytes_tick / 1024.0, completo / 1024.0, 100.0 * m->bytes_tick / completo);
+    return n < 0 ? 0 : (size_t) n < cap ? (size_t) n : cap - 1;
+}
+
+// -------------------------- POBLACIÓN INICIAL --------------------------
+//
+// Los agentes iniciales se reparten con un número exacto por especie y sin
+// sorteos por rechazo sobre el mundo entero. Las filas se agrupan en bloques
+// de FILAS_INICIO y un árbol binario sobre los bloques decide cuántos agentes
+// de cada especie van a cada mitad (una hipergeométrica por nodo, con los
+// pesos de la distribución), hasta llegar a cada bloque. Después cada bloque
+// se llena por su cuenta, en paralelo: por rechazo dentro del bloque si queda
+// más vacío que lleno, o eligiendo los huecos si queda más lleno. Todos los
+// sorteos están indexados por nodo o por bloque, así que el mundo no depende
+// del número de hilos ni de procesos: un proceso MPI solo baja por las ramas
+// que tocan sus filas y llena solo esos bloques.
+
+#define FILAS_INICIO      64    // Filas por bloque del reparto
+#define SORTEOS_EXACTOS   64    // Hasta aquí la hipergeométrica se sortea uno a uno
+#define LADO_GRUMO        32    // Celdas entre nodos de la rejilla de grumos
+#define GRUMOS_PCT        35    // % de nodos de la rejilla con mancha
+#define MUESTREO_PESO     8     // Paso con que se estima el peso de un bloque
+
+// Raíz cuadrada por Newton (evita enlazar libm para la aproximación normal)
+static double raiz(double x) {
+    if (x <= 0) return 0;
+    double r = x > 1 ? x : 1;
+    for (int k = 0; k < 64; k++) {
+        double s = 0.5 * (r + x / r);
+        if (s >= r) break;
+        r = s;
+    }
+    return r;
+}
+
+// k-ésimo valor de 32 bits de la secuencia (semilla, clave, flujo)
+static inline uint32_t uniforme(uint64_t semilla, uint64_t clave, uint64_t k, uint32_t flujo) {
+    return philox(semilla, clave, (uint32_t) (k / 4), flujo).v[k % 4];
+}
+
+// Índice uniforme en [0, n) a partir de 32 bits aleatorios (n puede pasar de 2^32)
+static inline size_t en_rango_grande(uint32_t r, size_t n) {
+    return (size_t) ((double) r * (double) n / 4294967296.0);
+}
+
+// Éxitos al sacar n sin reposición de N elementos con K éxitos. Con pocos
+// sorteos es exacta; con muchos usa la aproximación normal (suma de 12
+// uniformes), que sobra para repartir: los totales siguen siendo exactos.
+static long hipergeometrica(long N, long K, long n, uint64_t semilla, uint64_t clave) {
+    long lo = n - (N - K) > 0 ? n - (N - K) : 0;
+    long hi = n < K ? n : K;
+    if (lo >= hi) return lo;
+    if (n <= SORTEOS_EXACTOS) {
+        long x = 0;
+        for (long k = 0; k < n; k++)
+            if ((double) uniforme(semilla, clave, k, FLUJO_REPARTO) * (N - k) < (double) (K - x) * 4294967296.0) x++;
+        return x;
+    }
+    double media = (double) n * K / N;
+    double varianza = media * (N - K) / N * (N - n) / (N - 1);
+    double z = -6;
+    for (int k = 0; k < 12; k++) z += uniforme(semilla, clave, k, FLUJO_REPARTO) / 4294967296.0;
+    double x = media + z * raiz(varianza);
+    return x < lo ? lo : x > hi ? hi : (long) (x + 0.5);
+}
+
+// Sortea la rejilla de la distribución de grumos para un mundo de alto x
+// ancho: nodos cada LADO_GRUMO celdas, cada uno lleno (255) o vacío (0); la
+// interpolación entre nodos da manchas de bordes suaves
+static uint8_t *sortear_grumos(uint64_t semilla, int alto, int ancho, int *filas, int *columnas) {
+    *filas = alto / LADO_GRUMO + 2;
+    *columnas = ancho / LADO_GRUMO + 2;
+    size_t n = (size_t) *filas * *columnas;
+    uint8_t *peso = malloc(n);
+    if (peso == NULL) return NULL;
+    for (size_t k = 0; k < n; k++)
+        peso[k] = uniforme(semilla, 0, k, FLUJO_GRUMOS) < UMBRAL_PCT(GRUMOS_PCT) ? 255 : 0;
+    return peso;
+}
+
+// Peso (0 a 255) de la celda global (gi, j): interpolación bilineal de la
+// rejilla estirada sobre el mundo
+static unsigned peso_celda(const Distribucion *ds, int alto, int ancho, int gi, int j) {
+    double y = (gi + 0.5) * ds->filas / alto - 0.5;
+    double x = (j + 0.5) * ds->columnas / ancho - 0.5;
+    y = y < 0 ? 0 : y;
+    x = x < 0 ? 0 : x;
+    int f0 = (int) y, c0 = (int) x;
+    int f1 = f0 + 1 < ds->filas ? f0 + 1 : f0;
+    int c1 = c0 + 1 < ds->columnas ? c0 + 1 : c0;
+    double a = y - f0, b = x - c0;
+    const uint8_t *arriba = ds->peso + (size_t) f0 * ds->columnas;
+    const uint8_t *abajo = ds->peso + (size_t) f1 * ds->columnas;
+    double v = (1 - a) * ((1 - b) * arriba[c0] + b * arriba[c1]) + a * ((1 - b) * abajo[c0] + b * abajo[c1]);
+    return (unsigned) (v + 0.5);
+}
+
+// Lee una imagen PGM binaria (P5) como rejilla de pesos: blanco, donde más
+// agentes caen; negro, donde ninguno
+static int leer_pgm(const char *ruta, Distribucion *ds) {
+    FILE *f = fopen(ruta, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "No se pudo abrir la distribución %s\n", ruta);
+        return -1;
+    }
+    int campos[3], n = 0;
+    int ok = fgetc(f) == 'P' && fgetc(f) == '5';
+    while (ok && n < 3) {
+        int c = fgetc(f);
+        if (c == '#') {
+            while (c != '\n' && c != EOF) c = fgetc(f);
+        } else if (c >= '0' && c <= '9') {
+            ungetc(c, f);
+            ok = fscanf(f, "%d", &campos[n++]) == 1;
+        } else if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+            ok = 0;
+        }
+    }
+    ok = ok && fgetc(f) != EOF && campos[0] > 0 && campos[1] > 0 && campos[2] > 0 && campos[2] < 256;
+    size_t bytes = ok ? (size_t) campos[0] * campos[1] : 0;
+    ds->peso = ok ? malloc(bytes) : NULL;
+    ok = ds->peso != NULL && fread(ds->peso, 1, bytes, f) == bytes;
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "Distribución inválida (se espera un PGM binario P5): %s\n", ruta);
+        free(ds->peso);
+        ds->peso = NULL;
+        return -1;
+    }
+    for (size_t k = 0; k < bytes; k++) ds->peso[k] = (uint8_t) (ds->peso[k] * 255 / campos[2]);
+    ds->tipo = DISTRIBUCION_IMAGEN;
+    ds->columnas = campos[0];
+    ds->filas = campos[1];
+    return 0;
+}
+
+// Interpreta --distribucion: uniforme, grumos o la ruta de un PGM
+int leer_distribucion(const char *texto, Distribucion *ds) {
+    *ds = (Distribucion) {DISTRIBUCION_UNIFORME, 0, 0, NULL};
+    if (strcmp(texto, "uniforme") == 0) return 0;
+    if (strcmp(texto, "grumos") == 0) {
+        ds->tipo = DISTRIBUCION_GRUMOS;
+        return 0;
+    }
+    return leer_pgm(texto, ds);
+}
+
+// Estado del reparto por el árbol de bloques
+typedef struct {
+    const Mundo *m;
+    const double *acumulado;    // Peso de los bloques [0, b) (NULL: uniforme)
+    long (*cuenta)[4];          // Agentes de cada especie por bloque
+} Reparto;
+
+// Filas globales [g0, g1) del bloque o rango de bloques [b0, b1)
+static inline void filas_bloques(const Mundo *m, int b0, int b1, int *g0, int *g1) {
+    *g0 = b0 * FILAS_INICIO;
+    *g1 = b1 * FILAS_INICIO < m->alto_total ? b1 * FILAS_INICIO : m->alto_total;
+}
+
+// ¿Alguna de las filas globales [g0, g1) es de este proceso (propia o fantasma)?
+static bool filas_locales(const Mundo *m, int g0, int g1) {
+    int d = (g0 - m->fila0 + m->alto_total) % m->alto_total;
+    return d < m->alto || d + (g1 - g0) > m->alto_total;
+}
+
+// Reparte n[e] agentes de cada especie entre los bloques [b0, b1)
+static void repartir(const Reparto *r, int b0, int b1, const long n[4]) {
+    const Mundo *m = r->m;
+    int g0, g1;
+    filas_bloques(m, b0, b1, &g0, &g1);
+    if (!filas_locales(m, g0, g1)) return;
+    if (b1 - b0 == 1) {
+        memcpy(r->cuenta[b0], n, sizeof(r->cuenta[b0]));
+        return;
+    }
+
+    int mitad = (b0 + b1) / 2, gm;
+    filas_bloques(m, b0, mitad, &g0, &gm);
+    long celdas = (long) (g1 - g0) * m->ancho, izquierda = (long) (gm - g0) * m->ancho;
+    // Con pesos, la mitad izquierda cuenta como si tuviera las celdas que le
+    // tocan por peso; la capacidad real se respeta al recortar
+    long efectivas = izquierda;
+    if (r->acumulado != NULL) {
+        double total = r->acumulado[b1] - r->acumulado[b0];
+        if (total > 0) efectivas = (long) ((r->acumulado[mitad] - r->acumulado[b0]) / total * celdas + 0.5);
+    }
+
+    uint64_t clave = (uint64_t) b0 << 32 | (uint64_t) b1;
+    long todos = n[PLANT] + n[HERBIVORE] + n[CARNIVORE];
+    long a = hipergeometrica(celdas, efectivas, todos, m->semilla, clave);
+    long lo = todos - (celdas - izquierda), hi = todos < izquierda ? todos : izquierda;
+    a = a < lo ? lo : a > hi ? hi : a;
+
+    long ni[4] = {0}, nd[4] = {0};
+    ni[PLANT] = hipergeometrica(todos, n[PLANT], a, m->semilla, clave | 1ull << 62);
+    ni[HERBIVORE] = hipergeometrica(todos - n[PLANT], n[HERBIVORE], a - ni[PLANT], m->semilla, clave | 2ull << 62);
+    ni[CARNIVORE] = a - ni[PLANT] - ni[HERBIVORE];
+    for (int e = PLANT; e <= CARNIVORE; e++) nd[e] = n[e] - ni[e];
+    repartir(r, b0, mitad, ni);
+    repartir(r, mitad, b1, nd);
+}
+
+// Escribe un agente inicial en la celda global (gi, j), en los dos buffers,
+// si la fila es de este proceso
+static inline void poner_agente(Mundo *m, int gi, int j, int especie) {
+    int i = (gi - m->fila0 + m->alto_total) % m->alto_total;
+    if (i >= m->alto) return;
+    // Las plantas no usan los demás campos
+    int8_t energia = especie == PLANT ? 0 : (int8_t) saturar(m->reglas.energia_nuevo, INT8_MIN, ENERGIA_MAXIMA);
+    Celda c = {especie, energia, 0, 0};
+    escribir_celda(&m->ecosistema, pos(m, i, j), c);
+    escribir_celda(&m->siguiente, pos(m, i, j), c);
+}
+
+// Especie del agente número k del bloque: primero las plantas, después los
+// herbívoros y al final los carnívoros (el orden de colocación es aleatorio)
+static inline int especie_numero(long k, const long n[4]) {
+    return k < n[PLANT] ? PLANT : k < n[PLANT] + n[HERBIVORE] ? HERBIVORE : CARNIVORE;
+}
+
+// Llena el bloque b con n[e] agentes de cada especie. Un mapa de bits del
+// bloque lleva las celdas tomadas, así el bloque se sortea entero aunque solo
+// algunas de sus filas sean de este proceso.
+static int colocar_bloque(Mundo *m, const Distribucion *ds, int b, const long n[4]) {
+    int g0, g1;
+    filas_bloques(m, b, b + 1, &g0, &g1);
+    size_t celdas = (size_t) (g1 - g0) * m->ancho;
+    size_t todos = (size_t) (n[PLANT] + n[HERBIVORE] + n[CARNIVORE]);
+    if (todos == 0) return 0;
+    uint64_t *tomada = calloc((celdas + 63) / 64, sizeof(uint64_t));
+    if (tomada == NULL) return -1;
+    bool pesos = ds != NULL && ds->tipo != DISTRIBUCION_UNIFORME;
+
+    if (!pesos && 2 * todos > celdas) {
+        // Más lleno que vacío: se sortean los huecos y la especie de cada
+        // celda ocupada sale de las que faltan por colocar
+        for (size_t k = 0; k < celdas / 64; k++) tomada[k] = ~0ull;
+        if (celdas % 64) tomada[celdas / 64] = (1ull << (celdas % 64)) - 1;
+        // Los valores de cada secuencia se toman de a cuatro, uno por salida
+        // de philox
+        Aleatorio a;
+        size_t huecos = celdas - todos;
+        for (uint64_t t = 0; huecos > 0; t++) {
+            if (t % 4 == 0) a = philox(m->semilla, (uint64_t) b | 2ull << 62, (uint32_t) (t / 4), FLUJO_INICIO);
+            size_t k = en_rango_grande(a.v[t % 4], celdas);
+            if (!(tomada[k / 64] >> (k % 64) & 1)) continue;
+            tomada[k / 64] &= ~(1ull << (k % 64));
+            huecos--;
+        }
+        long falta[4] = {0, n[PLANT], n[HERBIVORE], n[CARNIVORE]};
+        long resto = (long) todos;
+        uint64_t t = 0;
+        for (size_t k = 0; k < celdas; k++) {
+            if (!(tomada[k / 64] >> (k % 64) & 1)) continue;
+            if (t % 4 == 0) a = philox(m->semilla, (uint64_t) b | 1ull << 62, (uint32_t) (t / 4), FLUJO_INICIO);
+            long x = (long) ((uint64_t) a.v[t++ % 4] * (uint64_t) resto >> 32);
+            int e = x < falta[PLANT] ? PLANT : x < falta[PLANT] + falta[HERBIVORE] ? HERBIVORE : CARNIVORE;
+            falta[e]--;
+            resto--;
+            poner_agente(m, g0 + (int) (k / m->ancho), (int) (k % m->ancho), e);
+        }
+        free(tomada);
+        return 0;
+    }
+
+    // Por rechazo: una celda al azar del bloque, aceptada según su peso si
+    // está libre. Si un peso muy bajo lo estanca, se completa recorriendo el
+    // bloque.
+    size_t colocados = 0;
+    uint64_t limite = 8 * (uint64_t) celdas + 64 * (uint64_t) todos;
+    if (limite > UINT32_MAX) limite = UINT32_MAX;
+    for (uint64_t t = 0; colocados < todos && t < limite; t++) {
+        Aleatorio a = philox(m->semilla, (uint64_t) b, (uint32_t) t, FLUJO_INICIO);
+        size_t k = en_rango_grande(a.v[0], celdas);
+        if (tomada[k / 64] >> (k % 64) & 1) continue;
+        int gi = g0 + (int) (k / m->ancho), j = (int) (k % m->ancho);
+        if (pesos && a.v[1] >> 24 >= peso_celda(ds, m->alto_total, m->ancho, gi, j)) continue;
+        tomada[k / 64] |= 1ull << (k % 64);
+        poner_agente(m, gi, j, especie_numero((long) colocados++, n));
+    }
+    for (int pasada = 0; pasada < 2 && colocados < todos; pasada++)
+        for (size_t k = 0; k < celdas && colocados < todos; k++) {
+            int gi = g0 + (int) (k / m->ancho), j = (int) (k % m->ancho);
+            if (tomada[k / 64] >> (k % 64) & 1) continue;
+            if (pasada == 0 && peso_celda(ds, m->alto_total, m->ancho, gi, j) == 0) continue;
+            tomada[k / 64] |= 1ull << (k % 64);
+            poner_agente(m, gi, j, especie_numero((long) colocados++, n));
+        }
+    free(tomada);
+    return 0;
+}
+
+// Coloca las poblaciones iniciales (recortadas a las celdas del mundo, con
+// prioridad en el orden plantas, herbívoros, carnívoros) según la
+// distribución (NULL: uniforme). El mundo tiene que estar recién creado: los
+// planos vienen en cero del mmap y no se vuelven a tocar salvo donde cae un
+// agente. Devuelve -1 si no hay memoria.
+int inicializar_ecosistema(Mundo *m, const Distribucion *ds,
+                           long num_plantas, long num_herviboros, long num_carnivoros) {
+    long celdas = (long) m->alto_total * m->ancho;
+    long n[4] = {0};
+    n[PLANT] = num_plantas < celdas ? num_plantas : celdas;
+    n[HERBIVORE] = num_herviboros < celdas - n[PLANT] ? num_herviboros : celdas - n[PLANT];
+    n[CARNIVORE] = num_carnivoros < celdas - n[PLANT] - n[HERBIVORE] ? num_carnivoros : celdas - n[PLANT] - n[HERBIVORE];
+
+    Distribucion grumos = {DISTRIBUCION_GRUMOS, 0, 0, NULL};
+    if (ds != NULL && ds->tipo == DISTRIBUCION_GRUMOS) {
+        grumos.peso = sortear_grumos(m->semilla, m->alto_total, m->ancho, &grumos.filas, &grumos.columnas);
+        if (grumos.peso == NULL) return -1;
+        ds = &grumos;
+    }
+    bool pesos = ds != NULL && ds->tipo != DISTRIBUCION_UNIFORME;
+
+    int bloques = (m->alto_total + FILAS_INICIO - 1) / FILAS_INICIO;
+    Reparto r = {m, NULL, calloc(bloques, sizeof(long[4]))};
+    double *acumulado = pesos ? malloc((bloques + 1) * sizeof(double)) : NULL;
+    if (r.cuenta == NULL || (pesos && acumulado == NULL)) {
+        free(r.cuenta);
+        free(acumulado);
+        free(grumos.peso);
+        return -1;
+    }
+
+    // Peso de cada bloque, estimado con una muestra de sus celdas: solo
+    // orienta el reparto, los totales son exactos igual
+    if (pesos) {
+        acumulado[0] = 0;
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int b = 0; b < bloques; b++) {
+            int g0, g1;
+            filas_bloques(m, b, b + 1, &g0, &g1);
+            double suma = 0;
+            for (int gi = g0 + (g1 - g0 - 1) % MUESTREO_PESO / 2; gi < g1; gi += MUESTREO_PESO)
+                for (int j = (m->ancho - 1) % MUESTREO_PESO / 2; j < m->ancho; j += MUESTREO_PESO)
+                    suma += peso_celda(ds, m->alto_total, m->ancho, gi, j);
+            acumulado[b + 1] = suma;
+        }
+        for (int b = 0; b < bloques; b++) acumulado[b + 1] += acumulado[b];
+        r.acumulado = acumulado;
+    }
+    repartir(&r, 0, bloques, n);
+
+    int errores = 0;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:errores)
+    for (int b = 0; b < bloques; b++) {
+        int g0, g1;
+        filas_bloques(m, b, b + 1, &g0, &g1);
+        if (filas_locales(m, g0, g1)) errores += colocar_bloque(m, ds, b, r.cuenta[b]) != 0;
+    }
+    free(r.cuenta);
+    free(acumulado);
+    free(grumos.peso);
+    return errores ? -1 : 0;
+}
+
+// ----------------------------- MÁSCARAS -----------------------------
+//
+// Antes de cada fase se clasifica el estado actual en máscaras de bits por
+// fila. Las reglas ya no recorren los vecinos celda por celda: para cada
+// palabra de 64 celdas se obtienen, con desplazamientos, palabras alineadas
+// con el vecino en cada dirección, y de ahí sale una máscara de 4 u 8 bits
+// por celda (bit d = el vecino en la dirección d de dx/dy cumple la
+// condición). Los bordes los resuelven las palabras y filas fantasma: en cero
+// con bordes, copia del otro lado en un toroide.
+
+// Primera palabra de datos de la fila i (i puede ser -1 o alto: filas fantasma)
+static inline uint64_t *fila_mascara(const Mascaras *mk, uint64_t *plano, int i) {
+    return plano + (size_t) (i + 1) * mk->paso + 1;
+}
+
+// Vecino oeste de cada celda de la palabra k
+static inline uint64_t oeste(const uint64_t *fila, int k) {
+    return fila[k] << 1 | fila[k - 1] >> 63;
+}
+
+// Vecino este de cada celda de la palabra k. En la última palabra la fantasma
+// entra justo después de la última celda (en un toroide trae la celda 0); el
+// corrimiento es un cmov, no un salto.
+static inline uint64_t este(const Mascaras *mk, const uint64_t *fila, int k) {
+    return fila[k] >> 1 | fila[k + 1] << (k + 1 == mk->palabras ? mk->corrimiento : 63);
+}
+
+// Vecino de cada celda de la palabra k de la fila i, por dirección (N, S, O,
+// E y, con vecindad de Moore, NO, NE, SO, SE)
+typedef struct {
+    uint64_t d[8];
+} Direcciones;
+
+EN_LINEA Direcciones direcciones(const Mascaras *mk, uint64_t *plano, int i, int k, int vecinos) {
+    const uint64_t *arriba = fila_mascara(mk, plano, i - 1);
+    const uint64_t *centro = fila_mascara(mk, plano, i);
+    const uint64_t *abajo = fila_mascara(mk, plano, i + 1);
+    Direcciones v = {{arriba[k], abajo[k], oeste(centro, k), este(mk, centro, k)}};
+    if (vecinos == 8) {
+        v.d[4] = oeste(arriba, k);
+        v.d[5] = este(mk, arriba, k);
+        v.d[6] = oeste(abajo, k);
+        v.d[7] = este(mk, abajo, k);
+    }
+    return v;
+}
+
+EN_LINEA uint64_t alguna_direccion(Direcciones v, int vecinos) {
+    uint64_t a = v.d[0] | v.d[1] | v.d[2] | v.d[3];
+    if (vecinos == 8) a |= v.d[4] | v.d[5] | v.d[6] | v.d[7];
+    return a;
+}
+
+// Máscara de bits (una por dirección) de la celda en el bit b
+EN_LINEA unsigned bits_celda(Direcciones v, int b, int vecinos) {
+    unsigned x = (unsigned) ((v.d[0] >> b & 1) | (v.d[1] >> b & 1) << 1 |
+                             (v.d[2] >> b & 1) << 2 | (v.d[3] >> b & 1) << 3);
+    if (vecinos == 8)
+        x |= (unsigned) ((v.d[4] >> b & 1) << 4 | (v.d[5] >> b & 1) << 5 |
+                         (v.d[6] >> b & 1) << 6 | (v.d[7] >> b & 1) << 7);
+    return x;
+}
+
+// Rellena lo fantasma de la fila i de un plano de máscaras según la
+// topología: las palabras a los lados de la fila y, si es la primera o la
+// última, la fila fantasma del otro extremo.
+static inline void envolver_fila(const Mundo *m, uint64_t *plano, int i) {
+    const Mascaras *mk = &m->mascaras;
+    uint64_t *fila = fila_mascara(mk, plano, i);
+    if (m->topologia.envolver_columnas) {
+        fila[-1] = (fila[mk->palabras - 1] >> mk->corrimiento & 1) << 63;
+        fila[mk->palabras] = fila[0] & 1;
+    }
+    if (m->topologia.envolver_filas) {
+        if (i == 0) memcpy(fila_mascara(mk, plano, m->alto) - 1, fila - 1, mk->paso * sizeof(uint64_t));
+        if (i == m->alto - 1) memcpy(fila_mascara(mk, plano, -1) - 1, fila - 1, mk->paso * sizeof(uint64_t));
+    }
+}
+
+// Clasifica 64 celdas consecutivas del plano de tipos en una palabra por tipo
+static inline void clasificar_64(const uint8_t *t, uint64_t out[4]) {
+#if defined(__AVX2__)
+    __m256i a = _mm256_loadu_si256((const __m256i *) t);
+    __m256i b = _mm256_loadu_si256((const __m256i *) (t + 32));
+    for (int c = 0; c < 4; c++) {
+        __m256i v = _mm256_set1_epi8((char) c);
+        uint32_t lo = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, v));
+        uint32_t hi = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(b, v));
+        out[c] = lo | (uint64_t) hi << 32;
+    }
+#elif defined(__SSE2__)
+    __m128i x[4];
+    for (int q = 0; q < 4; q++) x[q] = _mm_loadu_si128((const __m128i *) (t + 16 * q));
+    for (int c = 0; c < 4; c++) {
+        __m128i v = _mm_set1_epi8((char) c);
+        out[c] = 0;
+        for (int q = 0; q < 4; q++)
+            out[c] |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(x[q], v)) << (16 * q);
+    }
+#else
+    for (int c = 0; c < 4; c++) out[c] = 0;
+    for (int b = 0; b < 64; b++) out[t[b] & 3] |= 1ull << b;
+#endif
+}
+
+// Arma la lista de teselas activas de cada especie ordenadas de más a menos
+// agentes (por potencias de dos, con un conteo en cubetas en O(teselas)). Así
+// el reparto dinámico empieza por las teselas pesadas y las livianas rellenan
+// los huecos al final. Fuera de memoria quedan en orden de tesela, para
+// recorrerlas franja a franja.
+static void ordenar_activas(Teselas *ts) {
+    for (int e = PLANT; e <= CARNIVORE; e++) {
+        if (ts->en_orden) {
+            int n = 0;
+            for (int t = 0; t < ts->total; t++)
+                if (ts->conteo[e][t]) ts->activas[e][n++] = (uint32_t) t;
+            ts->num_activas[e] = n;
+            continue;
+        }
+        int inicio[34] = {0};
+        for (int t = 0; t < ts->total; t++) {
+            uint32_t c = ts->conteo[e][t];
+            if (c) inicio[32 - __builtin_clz(c)]++;
+        }
+        // Cubeta 32 (las más pobladas) primero
+        int acum = 0;
+        for (int b = 32; b >= 1; b--) {
+            int n = inicio[b];
+            inicio[b] = acum;
+            acum += n;
+        }
+        for (int t = 0; t < ts->total; t++) {
+            uint32_t c = ts->conteo[e][t];
+            if (c) ts->activas[e][inicio[32 - __builtin_clz(c)]++] = (uint32_t) t;
+        }
+        ts->num_activas[e] = acum;
+    }
+}
+
+// Pone las máscaras y el conteo por teselas al día con el estado actual
+// rehaciendo solo las teselas que las fases escribieron desde la última vez
+// (ver marcar_celda) y, para las derivadas, sus vecinas: el resto sigue
+// valiendo, así el costo sigue a la actividad y no al área. Lo deben llamar
+// todos los hilos del equipo (las pasadas están separadas por barreras
+// porque las derivadas leen filas vecinas).
+void actualizar_mascaras(Mundo *m) {
+    Mascaras *mk = &m->mascaras;
+    Teselas *ts = &m->teselas;
+    const uint8_t *tipo = m->ecosistema.tipo;
+
+    for (int f = 0, f0, f1; franja(m, f, &f0, &f1); f++) {
+        #pragma omp for schedule(static) nowait
+        for (int i = f0; i < f1; i++) {
+            const uint8_t *t = tipo + pos(m, i, 0);
+            uint64_t *fila[4];
+            for (int c = 0; c < 4; c++) fila[c] = fila_mascara(mk, mk->tipo[c], i);
+
+            bool cambio = false;
+            for (int k0, k1 = 0; siguiente_tramo(m, i, m->teselas.sucia, &k0, &k1);) {
+                cambio = true;
+                INSTRUMENTAR(m, palabras, k1 - k0);
+                int k = k0;
+                for (; k < k1 && 64 * (k + 1) <= m->ancho; k++) {
+                    uint64_t w[4];
+                    clasificar_64(t + 64 * k, w);
+                    for (int c = 0; c < 4; c++) fila[c][k] = w[c];
+                }
+                if (k < k1) {
+                    // Resto de la fila: los bits más allá del ancho quedan en cero
+                    uint64_t w[4] = {0, 0, 0, 0};
+                    for (int j = 64 * k; j < m->ancho; j++) w[t[j] & 3] |= 1ull << (j - 64 * k);
+                    for (int c = 0; c < 4; c++) fila[c][k] = w[c];
+                }
+            }
+            for (int c = 0; c < 4; c++) envolver_fila(m, mk->tipo[c], i);
+            if (cambio && m->reglas.radio_percepcion > 0) marcar_fila_campo(m, i);
+        }
+
+        pasar_franja(m, f);
+    }
+
+    // Las derivadas de una tesela dependen de las vecinas: se marcan aquí,
+    // una vez por tesela, y no por cada fila que las recorre
+    #pragma omp for schedule(static) nowait
+    for (int t = 0; t < ts->total; t++) ts->derivar[t] = vecindad_sucia(m, t);
+    barrera(m);
+
+    for (int f = 0, f0, f1; franja(m, f, &f0, &f1); f++) {
+        #pragma omp for schedule(static) nowait
+        for (int i = f0; i < f1; i++) {
+            const uint64_t *vacio = fila_mascara(mk, mk->tipo[EMPTY], i);
+            uint64_t *seguro = fila_mascara(mk, mk->seguro, i);
+            uint64_t *cerca = fila_mascara(mk, mk->cerca_planta, i);
+            for (int k0, k1 = 0; siguiente_tramo(m, i, m->teselas.derivar, &k0, &k1);)
+                for (int k = k0; k < k1; k++) {
+                    uint64_t carnivoro, planta;
+                    if (m->topologia.vecinos == 8) {
+                        carnivoro = alguna_direccion(direcciones(mk, mk->tipo[CARNIVORE], i, k, 8), 8);
+                        planta = alguna_direccion(direcciones(mk, mk->tipo[PLANT], i, k, 8), 8);
+                    } else {
+                        carnivoro = alguna_direccion(direcciones(mk, mk->tipo[CARNIVORE], i, k, 4), 4);
+                        planta = alguna_direccion(direcciones(mk, mk->tipo[PLANT], i, k, 4), 4);
+                    }
+                    seguro[k] = vacio[k] & ~carnivoro;
+                    cerca[k] = vacio[k] & planta;
+                }
+            envolver_fila(m, mk->seguro, i);
+            envolver_fila(m, mk->cerca_planta, i);
+        }
+
+        // El conteo solo lee las máscaras de tipos: no necesita otra barrera
+        #pragma omp for schedule(static) nowait
+        for (int t = f0 / TESELA_FILAS * ts->columnas; t < (f1 + TESELA_FILAS - 1) / TESELA_FILAS * ts->columnas; t++) {
+            if (!ts->sucia[t]) continue;
+            int i0, i1, k0, k1;
+            limites_tesela(m, t, &i0, &i1, &k0, &k1);
+            for (int e = PLANT; e <= CARNIVORE; e++) {
+                uint32_t c = 0;
+                for (int i = i0; i < i1; i++) {
+                    const uint64_t *fila = fila_mascara(mk, mk->tipo[e], i);
+                    for (int k = k0; k < k1; k++) c += (uint32_t) __builtin_popcountll(fila[k]);
+                }
+                ts->conteo[e][t] = c;
+            }
+        }
+        pasar_franja(m, f);
+    }
+    barrera(m);
+
+    #pragma omp single
+    {
+        memset(ts->sucia, 0, ts->total);
+        ordenar_activas(ts);
+    }
+}
+
+// Reconstruye las máscaras y el conteo por teselas a partir del estado
+// actual, sin suponer nada de las anteriores. Lo deben llamar todos los hilos
+// del equipo.
+void construir_mascaras(Mundo *m) {
+    #pragma omp single
+    memset(m->teselas.sucia, 1, m->teselas.total);
+    actualizar_mascaras(m);
+}
+
+// Kernel que procesa los agentes de una palabra de 64 celdas (fila i, palabra k)
+typedef void (*KernelPalabra)(Mundo *m, int i, int k);
+
+// Trabajo de una especie dentro de una pasada
+typedef struct {
+    int especie;
+    KernelPalabra kernel;
+} Trabajo;
+
+// Recorre las teselas activas de una o más especies en un solo reparto
+// dinámico: cada hilo toma la siguiente tesela libre de la lista combinada, y
+// las teselas sin agentes ni se visitan. Fuera de memoria hay un reparto por
+// franja. Con "filas", solo se visitan las teselas de las filas de teselas
+// marcadas. Es un "omp for" huérfano: lo deben llamar todos los hilos del
+// equipo y termina con barrera.
+void recorrer_activas(Mundo *m, const Trabajo *trabajos, int num_trabajos, const unsigned char *filas) {
+    const Teselas *ts = &m->teselas;
+    const Mascaras *mk = &m->mascaras;
+    int desde[4] = {0}, hasta[4] = {0};
+
+    for (int f = 0, f0, f1; franja(m, f, &f0, &f1); f++) {
+        // Con las activas en orden de tesela, las de la franja son el tramo
+        // siguiente de cada lista; en memoria la única franja las toma todas
+        int limite = (f1 + TESELA_FILAS - 1) / TESELA_FILAS * ts->columnas;
+        int total = 0;
+        for (int q = 0; q < num_trabajos; q++) {
+            const uint32_t *activas = ts->activas[trabajos[q].especie];
+            int n = ts->num_activas[trabajos[q].especie];
+            desde[q] = hasta[q];
+            if (!ts->en_orden) hasta[q] = n;
+            while (hasta[q] < n && (int) activas[hasta[q]] < limite) hasta[q]++;
+            total += hasta[q] - desde[q];
+        }
+
+        #pragma omp for schedule(dynamic, 1) nowait
+        for (int n = 0; n < total; n++) {
+            int q = 0, resto = n;
+            while (resto >= hasta[q] - desde[q]) resto -= hasta[q] - desde[q], q++;
+            const Trabajo *tr = &trabajos[q];
+
+            int t = (int) ts->activas[tr->especie][desde[q] + resto];
+            if (filas != NULL && !filas[t / ts->columnas]) continue;
+            int i0, i1, k0, k1;
+            limites_tesela(m, t, &i0, &i1, &k0, &k1);
+            INSTRUMENTAR(m, palabras, (i1 - i0) * (k1 - k0));
+            INSTRUMENTAR(m, agentes, ts->conteo[tr->especie][t]);
+            for (int i = i0; i < i1; i++) {
+                const uint64_t *fila = fila_mascara(mk, mk->tipo[tr->especie], i);
+                for (int k = k0; k < k1; k++)
+                    if (fila[k]) tr->kernel(m, i, k);
+            }
+        }
+        pasar_franja(m, f);
+    }
+    barrera(m);
+}
+
+// ------------------------------- CAMPO -------------------------------
+//
+// Con radio de percepción, un herbívoro ve más allá de sus vecinos: al
+// buscar comida se mueve hacia donde ve más plantas y al huir hacia donde ve
+// menos carnívoros. Contar celda por celda costaría O(r²) por herbívoro; en
+// cambio, antes de la fase se arma una tabla de sumas de plantas y
+// carnívoros por bloques de LADO_CAMPO x LADO_CAMPO celdas, y contar un
+// cuadrado de cualquier radio son cuatro lecturas (por tramo, si cruza el
+// borde de un toroide). La tabla sigue a la actividad: en modo denso
+// actualizar_mascaras anota las filas que cambiaron, solo se recuentan sus
+// filas de bloques (popcount de las máscaras) y la tabla se rehace desde la
+// primera; en modo disperso se recuenta desde las listas, en O(agentes). El
+// campo depende solo del estado, así que la firma no cambia con el modo, los
+// hilos ni los procesos (ver DISTRIBUIDO).
+
+#define COLUMNAS_SUMA 256   // Columnas de bloques por trabajo al acumular la tabla
+
+static const int ESPECIES_CAMPO[] = {PLANT, CARNIVORE};
+
+// Recuenta las filas de bloques que cambiaron (en modo denso, desde las
+// máscaras de tipos de las filas propias) o todas (en modo disperso, desde
+// las listas), y deja en campo.primera la primera fila de la tabla que hay
+// que rehacer. Lo deben llamar todos los hilos del equipo.
+void contar_campo(Mundo *m) {
+    Campo *ca = &m->campo;
+    const Mascaras *mk = &m->mascaras;
+
+    #pragma omp single
+    {
+        ca->primera = 0;
+        if (!m->disperso)
+            while (ca->primera < ca->filas && !ca->sucia[ca->primera]) ca->primera++;
+    }
+
+    if (!m->disperso) {
+        #pragma omp for schedule(dynamic, 1) nowait
+        for (int f = ca->primera; f < ca->filas; f++) {
+            if (!ca->sucia[f]) continue;
+            ca->sucia[f] = 0;
+            int g1 = (f + 1) * LADO_CAMPO < m->alto_total ? (f + 1) * LADO_CAMPO : m->alto_total;
+            for (int n = 0; n < 2; n++) {
+                int e = ESPECIES_CAMPO[n];
+                uint32_t *fila = ca->fila[e] + (size_t) f * ca->columnas;
+                memset(fila, 0, ca->columnas * sizeof(uint32_t));
+                for (int g = f * LADO_CAMPO; g < g1; g++) {
+                    int i = (g - m->fila0 + m->alto_total) % m->alto_total;
+                    if (i < ca->propia0 || i >= ca->propia1) continue;
+                    const uint64_t *w = fila_mascara(mk, mk->tipo[e], i);
+                    for (int k = 0; k < mk->palabras; k++) {
+                        if (!w[k]) continue;
+                        int b0 = 64 / LADO_CAMPO * k;
+                        int b1 = b0 + 64 / LADO_CAMPO < ca->columnas ? b0 + 64 / LADO_CAMPO : ca->columnas;
+                        for (int b = b0; b < b1; b++)
+                            fila[b] += (uint32_t) __builtin_popcountll(w[k] >> (LADO_CAMPO * (b - b0)) &
+                                                                       ((1ull << LADO_CAMPO) - 1));
+                    }
+                }
+                for (int b = 1; b < ca->columnas; b++) fila[b] += fila[b - 1];
+            }
+        }
+        barrera(m);
+        return;
+    }
+
+    #pragma omp for schedule(static) nowait
+    for (int f = 0; f < ca->filas; f++) {
+        ca->sucia[f] = 0;
+        for (int n = 0; n < 2; n++)
+            memset(ca->fila[ESPECIES_CAMPO[n]] + (size_t) f * ca->columnas, 0, ca->columnas * sizeof(uint32_t));
+    }
+    barrera(m);
+    for (int n = 0; n < 2; n++) {
+        const Lista *l = &m->agentes[ESPECIES_CAMPO[n]];
+        uint32_t *fila = ca->fila[ESPECIES_CAMPO[n]];
+        #pragma omp for schedule(static) nowait
+        for (size_t a = 0; a < l->n; a++) {
+            size_t g = pos_global(m, l->a[a].pos);
+            size_t b = g / m->ancho / LADO_CAMPO * ca->columnas + g % m->ancho / LADO_CAMPO;
+            __atomic_fetch_add(&fila[b], 1, __ATOMIC_RELAXED);
+        }
+    }
+    barrera(m);
+    #pragma omp for schedule(static) nowait
+    for (int f = 0; f < ca->filas; f++)
+        for (int n = 0; n < 2; n++) {
+            uint32_t *fila = ca->fila[ESPECIES_CAMPO[n]] + (size_t) f * ca->columnas;
+            for (int b = 1; b < ca->columnas; b++) fila[b] += fila[b - 1];
+        }
+    barrera(m);
+}
+
+// Rehace la tabla de sumas desde la fila campo.primera con los prefijos por
+// fila de "fuente" (los del campo o, repartido, los sumados entre procesos):
+// cada hilo acumula hacia abajo un grupo de columnas. Lo deben llamar todos
+// los hilos del equipo.
+void sumar_campo(Mundo *m, uint32_t *const fuente[4]) {
+    Campo *ca = &m->campo;
+    size_t paso = (size_t) ca->columnas + 1;
+
+    #pragma omp for schedule(static) nowait
+    for (int c0 = 0; c0 < ca->columnas; c0 += COLUMNAS_SUMA) {
+        int c1 = c0 + COLUMNAS_SUMA < ca->columnas ? c0 + COLUMNAS_SUMA : ca->columnas;
+        for (int n = 0; n < 2; n++) {
+            int e = ESPECIES_CAMPO[n];
+            for (int f = ca->primera; f < ca->filas; f++) {
+                const uint32_t *fila = fuente[e] + (size_t) f * ca->columnas;
+                const uint32_t *arriba = ca->suma[e] + f * paso + 1;
+                uint32_t *abajo = ca->suma[e] + (f + 1) * paso + 1;
+                for (int b = c0; b < c1; b++) abajo[b] = arriba[b] + fila[b];
+            }
+        }
+    }
+    barrera(m);
+}
+
+// Pone el campo al día con el estado actual, antes de la fase de herbívoros
+// (solo con radio de percepción). Lo deben llamar todos los hilos del equipo.
+void actualizar_campo(Mundo *m) {
+    contar_campo(m);
+    sumar_campo(m, m->campo.fila);
+}
+
+// Tramos de bloques [t[n][0], t[n][1]) que cubren las celdas [lo, hi] de una
+// dimensión de n celdas; devuelve cuántos hay (0 a 2). Con vuelta, un
+// cuadrado que cruza el borde se parte en dos sin repetir bloques.
+static inline int tramos_campo(int lo, int hi, int n, bool vuelta, int t[2][2]) {
+    if (vuelta && hi - lo + 1 >= n) {
+        lo = 0;
+        hi = n - 1;
+    } else if (vuelta) {
+        lo = (lo % n + n) % n;
+        hi = (hi % n + n) % n;
+        if (lo > hi) {
+            t[0][0] = lo / LADO_CAMPO;
+            t[0][1] = (n - 1) / LADO_CAMPO + 1;
+            t[1][0] = 0;
+            t[1][1] = hi / LADO_CAMPO + 1 < t[0][0] ? hi / LADO_CAMPO + 1 : t[0][0];
+            return t[1][1] > 0 ? 2 : 1;
+        }
+    }
+    lo = lo < 0 ? 0 : lo;
+    hi = hi < n ? hi : n - 1;
+    if (lo > hi) return 0;
+    t[0][0] = lo / LADO_CAMPO;
+    t[0][1] = hi / LADO_CAMPO + 1;
+    return 1;
+}
+
+// Agentes de la especie en los bloques [f0, f1) x [c0, c1)
+static inline uint32_t suma_bloques(const Campo *ca, int e, int f0, int f1, int c0, int c1) {
+    const uint32_t *s = ca->suma[e];
+    size_t paso = (size_t) ca->columnas + 1;
+    return s[f1 * paso + c1] - s[f0 * paso + c1] - s[f1 * paso + c0] + s[f0 * paso + c0];
+}
+
+// Agentes de la especie (PLANT o CARNIVORE) en el cuadrado de radio r
+// centrado en la fila global g y la columna j, contando enteros los bloques
+// que toca. Las filas dan la vuelta junto con las columnas: repartido, la
+// topología local no envuelve filas, pero el campo es del mundo completo.
+static uint32_t densidad(const Mundo *m, int e, int g, int j, int r) {
+    bool vuelta = m->topologia.envolver_columnas;
+    int f[2][2], c[2][2];
+    int nf = tramos_campo(g - r, g + r, m->alto_total, vuelta, f);
+    int nc = tramos_campo(j - r, j + r, m->ancho, vuelta, c);
+    uint32_t total = 0;
+    for (int a = 0; a < nf; a++)
+        for (int b = 0; b < nc; b++) total += suma_bloques(&m->campo, e, f[a][0], f[a][1], c[b][0], c[b][1]);
+    return total;
+}
+
+// Dirección de "candidatas" (máscara de vecinos) cuyo cuadrado de radio r,
+// centrado a r celdas en esa dirección, tiene más agentes de la especie (o
+// menos, con "menos"); a igualdad, la primera. Buscando más, -1 si ninguno
+// tiene alguno.
+static int mirar_lejos(const Mundo *m, int i, int j, unsigned candidatas, int e, bool menos, int r) {
+    int g = m->fila0 + i, mejor = -1;
+    uint32_t visto = 0;
+    for (; candidatas; candidatas &= candidatas - 1) {
+        int d = __builtin_ctz(candidatas);
+        uint32_t n = densidad(m, e, g + dx[d] * r, j + dy[d] * r, r);
+        if (mejor < 0 ? menos || n > 0 : menos ? n < visto : n > visto) {
+            mejor = d;
+            visto = n;
+        }
+    }
+    return mejor;
+}
+
+// ------------------------------ REGLAS ------------------------------
+//
+// Las fases de animales no usan locks: en una primera pasada cada animal
+// decide qué hacer leyendo solo el estado actual y deja su propuesta en
+// m->propuesta; tras la barrera, una segunda pasada aplica las propuestas.
+// Si varios animales piden la misma celda destino gana siempre el de menor
+// índice lineal, así el resultado no depende de qué hilo llega primero. Los
+// perdedores se quedan donde estaban como si no hubieran hecho nada.
+// Plantas y carnívoros comparten fase y buffer "siguiente": una celda vacía
+// pedida por un carnívoro nunca se siembra, así que el resultado tampoco
+// depende del orden entre las dos especies.
+
+#define ACCION_NADA       0   // Permanece y envejece
+#define ACCION_MUERE      1
+#define ACCION_MUEVE      2   // Huir o desplazarse a una celda vacía
+#define ACCION_COME       3
+#define ACCION_REPRODUCE  4
+
+#define ACCION(p)    ((p) & 7)
+#define DIRECCION(p) ((p) >> 3)
+
+static inline uint8_t proponer(int accion, int d) {
+    return (uint8_t) (d << 3 | accion);
+}
+
+// Primera dirección (en el orden de dx/dy) de una máscara de vecinos no vacía
+static inline int primera(unsigned mascara) {
+    return __builtin_ctz(mascara);
+}
+
+// Vecinos de una celda por categoría (máscaras de 4 u 8 bits, ver bits_celda)
+typedef struct {
+    unsigned vacio, planta, herbivoro, carnivoro;
+    unsigned seguro;        // Vecino vacío sin carnívoros alrededor
+    unsigned cerca_planta;  // Vecino vacío con alguna planta alrededor
+} Vecindad;
+
+static const Celda CELDA_VACIA = {EMPTY, 0, 0, 0};
+
+// ¿El vecino (qi, qj) propuso moverse, comer o criar en (ti, tj)?
+static inline bool pide_destino(const Mundo *m, int qi, int qj, uint8_t p, int ti, int tj) {
+    int ai, aj;
+    if (ACCION(p) < ACCION_MUEVE) return false;
+    vecino(m, qi, qj, DIRECCION(p), &ai, &aj);
+    return ai == ti && aj == tj;
+}
+
+// ¿El animal en "origen" se queda con el destino (ti, tj)? Solo puede
+// perderlo contra un vecino del destino de la misma especie, con menor
+// índice, que haya pedido esa misma celda. El índice es el global: en un
+// toroide repartido el vecino de arriba de la primera fila es de las últimas.
+static int gana_destino(const Mundo *m, int ti, int tj, size_t origen, int especie, int vecinos) {
+    const Planos *eco = &m->ecosistema;
+    size_t g = pos_global(m, origen);
+    for (int d = 0; d < vecinos; d++) {
+        int qi, qj;
+        if (!vecino(m, ti, tj, d, &qi, &qj)) continue;
+        size_t q = pos(m, qi, qj);
+        if (eco->tipo[q] != especie || pos_global(m, q) >= g) continue;
+        if (pide_destino(m, qi, qj, m->propuesta[q], ti, tj)) return 0;
+    }
+    return 1;
+}
+
+// ¿Algún carnívoro pidió la celda vacía (ti, tj) para moverse o reproducirse?
+// Las plantas corren junto con la segunda pasada de carnívoros y ceden esas
+// celdas: un carnívoro que entra siempre gana a una semilla.
+static int reclamada_por_carnivoro(const Mundo *m, int ti, int tj, int vecinos) {
+    for (int d = 0; d < vecinos; d++) {
+        int qi, qj;
+        if (!vecino(m, ti, tj, d, &qi, &qj)) continue;
+        size_t q = pos(m, qi, qj);
+        if (m->ecosistema.tipo[q] == CARNIVORE && pide_destino(m, qi, qj, m->propuesta[q], ti, tj)) return 1;
+    }
+    return 0;
+}
+
+// Sorteo de siembra de la planta en la celda local p: un valor por dirección.
+// Las diagonales salen de un flujo aparte, así la vecindad de von Neumann
+// sortea exactamente lo mismo que antes.
+EN_LINEA void sortear_siembra(const Mundo *m, size_t p, int vecinos, uint32_t sorteo[8]) {
+    Aleatorio r = philox(m->semilla, pos_global(m, p), (uint32_t) m->tick, FLUJO_SIEMBRA);
+    for (int d = 0; d < 4; d++) sorteo[d] = r.v[d];
+    if (vecinos == 8) {
+        r = philox(m->semilla, pos_global(m, p), (uint32_t) m->tick, FLUJO_SIEMBRA_DIAGONAL);
+        for (int d = 0; d < 4; d++) sorteo[4 + d] = r.v[d];
+    }
+}
+
+// Plantas de la palabra k de la fila i
+EN_LINEA void plantas_palabra_con(Mundo *m, int i, int k, const Reglas *rg, int vecinos) {
+    Mascaras *mk = &m->mascaras;
+    Planos *sig = &m->siguiente;
+    Contadores *cont = contadores_hilo(m);
+    Direcciones vacio = direcciones(mk, mk->tipo[EMPTY], i, k, vecinos);
+    uint32_t umbral = UMBRAL_PCT(rg->prob_siembra);
+
+    for (uint64_t w = fila_mascara(mk, mk->tipo[PLANT], i)[k]; w; w &= w - 1) {
+        int b = __builtin_ctzll(w);
+        int j = 64 * k + b;
+        unsigned vecinos_V = bits_celda(vacio, b, vecinos);
+
+        // Muerte si no hay espacio
+        if (vecinos_V == 0) {
+            sig->tipo[pos(m, i, j)] = EMPTY;
+            marcar_celda(m, i, j);
+            cont->muertes[PLANT][CAUSA_SIN_ESPACIO]++;
+            continue;
+        }
+
+        // Reproducción/expansión hacia vecinos vacíos que ningún carnívoro
+        // pidió. Un solo sorteo por planta da un valor por dirección. Varias
+        // plantas pueden sembrar la misma celda: la toma (y cuenta el
+        // nacimiento) la primera que la cambia de vacía a planta.
+        uint32_t sorteo[8];
+        sortear_siembra(m, pos(m, i, j), vecinos, sorteo);
+        for (; vecinos_V; vecinos_V &= vecinos_V - 1) {
+            int d = primera(vecinos_V);
+            if (sorteo[d] >= umbral) continue;
+            int ni, nj;
+            vecino(m, i, j, d, &ni, &nj);
+            INSTRUMENTAR(m, reclamos, 1);
+            if (reclamada_por_carnivoro(m, ni, nj, vecinos)) {
+                INSTRUMENTAR(m, conflictos, 1);
+                continue;
+            }
+            uint8_t vacia = EMPTY;
+            if (__atomic_compare_exchange_n(&sig->tipo[pos(m, ni, nj)], &vacia, PLANT, false,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                marcar_celda(m, ni, nj);
+                cont->nacimientos[PLANT]++;
+            } else {
+                INSTRUMENTAR(m, conflictos, 1);
+            }
+        }
+    }
+}
+
+// Resultado de aplicar la propuesta de un animal
+typedef struct {
+    size_t destino;         // Celda final del animal, SIN_POSICION si murió
+    Celda animal;           // Estado con que termina
+    size_t cria;            // Celda de la cría, SIN_POSICION si no tuvo
+    int causa;              // Causa de muerte, si murió
+    bool come;              // Se comió a la presa del destino
+} Resultado;
+
+// Causa de muerte de un animal que decidió ACCION_MUERE
+EN_LINEA int causa_muerte(const Reglas *rg, Celda c) {
+    return c.energia <= 0 || c.ticks_sin_comer >= rg->max_ticks_sin_comer ? CAUSA_HAMBRE : CAUSA_VEJEZ;
+}
+
+// Suma a los contadores del hilo los eventos de un resultado
+static inline void contar_resultado(Mundo *m, Resultado r, int especie) {
+    Contadores *c = contadores_hilo(m);
+    if (r.destino == SIN_POSICION) c->muertes[especie][r.causa]++;
+    if (r.cria != SIN_POSICION) c->nacimientos[especie]++;
+    if (r.come) c->muertes[especie == HERBIVORE ? PLANT : HERBIVORE][CAUSA_DEPREDACION]++;
+}
+
+// Escribe en "siguiente" el resultado del animal que estaba en (i, j)
+EN_LINEA void escribir_resultado(Mundo *m, const Reglas *rg, int i, int j, Resultado r, int especie) {
+    Planos *sig = &m->siguiente;
+    size_t p = pos(m, i, j);
+    contar_resultado(m, r, especie);
+
+    if (r.cria != SIN_POSICION) {
+        escribir_celda(sig, r.cria, (Celda) {especie, rg->energia_nuevo, 0, 0});
+        marcar_celda(m, (int) (r.cria / m->ancho), (int) (r.cria % m->ancho));
+    }
+    if (r.destino != p) escribir_celda(sig, p, CELDA_VACIA);
+    if (r.destino != SIN_POSICION) {
+        escribir_celda(sig, r.destino, r.animal);
+        marcar_celda(m, (int) (r.destino / m->ancho), (int) (r.destino % m->ancho));
+    }
+    marcar_celda(m, i, j);
+}
+
+// Muerte al inicio de la fase de un animal: sin energía, demasiados ticks sin
+// comer o vejez
+EN_LINEA bool muere(const Reglas *rg, Celda c) {
+    return c.energia <= 0 ||
+           c.ticks_sin_comer >= rg->max_ticks_sin_comer ||
+           c.edad >= rg->edad_maxima;
+}
+
+// Acción de un carnívoro que sigue vivo (el modo disperso ya apartó a los que
+// mueren, ver AGENTES)
+EN_LINEA uint8_t elegir_carnivoro(const Reglas *rg, Celda c, const Vecindad *v) {
+    // 2. Comer (prioridad)
+    if (v->herbivoro) return proponer(ACCION_COME, primera(v->herbivoro));
+
+    // 3. Reproducirse (si no comió)
+    if (c.energia >= rg->energia_reproduccion && v->vacio)
+        return proponer(ACCION_REPRODUCE, primera(v->vacio));
+
+    // 4. Moverse (si no comió ni se reprodujo)
+    if (v->vacio) return proponer(ACCION_MUEVE, primera(v->vacio));
+
+    // 5. Si no hizo nada, permanece y envejece
+    return ACCION_NADA;
+}
+
+// Primera pasada de carnívoros: decide la acción leyendo el estado actual
+EN_LINEA uint8_t decidir_carnivoro(const Reglas *rg, Celda c, const Vecindad *v) {
+    // 1. Muerte al inicio
+    if (muere(rg, c)) return ACCION_MUERE;
+    return elegir_carnivoro(rg, c, v);
+}
+
+// Segunda pasada de carnívoros: resuelve la propuesta del carnívoro en (i, j)
+EN_LINEA Resultado resolver_carnivoro(const Mundo *m, const Reglas *rg, int vecinos, int i, int j, Celda animal) {
+    size_t p = pos(m, i, j);
+    uint8_t prop = m->propuesta[p];
+    int accion = ACCION(prop);
+    Resultado r = {SIN_POSICION, animal, SIN_POSICION, 0, false};
+
+    if (accion == ACCION_MUERE) {
+        r.causa = causa_muerte(rg, animal);
+        return r;
+    }
+
+    int ti = i, tj = j;
+    if (accion >= ACCION_MUEVE) {
+        vecino(m, i, j, DIRECCION(prop), &ti, &tj);
+        INSTRUMENTAR(m, reclamos, 1);
+        if (!gana_destino(m, ti, tj, p, CARNIVORE, vecinos)) {
+            accion = ACCION_NADA;
+            INSTRUMENTAR(m, conflictos, 1);
+        }
+    }
+
+    r.destino = p;
+    switch (accion) {
+        case ACCION_COME:
+            r.come = true;
+            r.animal.energia += 2;
+            r.animal.ticks_sin_comer = 0;
+            r.animal.edad++;
+            r.destino = pos(m, ti, tj);
+            break;
+        case ACCION_REPRODUCE:
+            r.cria = pos(m, ti, tj);
+            r.animal.energia -= 2;  // reducir energía en la posición original
+            break;
+        case ACCION_MUEVE:
+            r.animal.ticks_sin_comer++;
+            r.animal.edad++;
+            r.destino = pos(m, ti, tj);
+            break;
+        default:
+            r.animal.ticks_sin_comer++;
+            r.animal.edad++;
+    }
+
+    // 6. Pierde energía en la celda final
+    r.animal.energia--;
+    return r;
+}
+
+EN_LINEA void proponer_carnivoros_con(Mundo *m, int i, int k, const Reglas *rg, int vecinos) {
+    Mascaras *mk = &m->mascaras;
+    Direcciones vacio = direcciones(mk, mk->tipo[EMPTY], i, k, vecinos);
+    Direcciones herbivoro = direcciones(mk, mk->tipo[HERBIVORE], i, k, vecinos);
+
+    for (uint64_t w = fila_mascara(mk, mk->tipo[CARNIVORE], i)[k]; w; w &= w - 1) {
+        int b = __builtin_ctzll(w);
+        size_t p = pos(m, i, 64 * k + b);
+        Vecindad v = {
+            .vacio = bits_celda(vacio, b, vecinos),
+            .herbivoro = bits_celda(herbivoro, b, vecinos),
+        };
+        m->propuesta[p] = decidir_carnivoro(rg, leer_celda(&m->ecosistema, p), &v);
+    }
+}
+
+EN_LINEA void aplicar_carnivoros_con(Mundo *m, int i, int k, const Reglas *rg, int vecinos) {
+    for (uint64_t w = fila_mascara(&m->mascaras, m->mascaras.tipo[CARNIVORE], i)[k]; w; w &= w - 1) {
+        int j = 64 * k + __builtin_ctzll(w);
+        Celda c = leer_celda(&m->ecosistema, pos(m, i, j));
+        escribir_resultado(m, rg, i, j, resolver_carnivoro(m, rg, vecinos, i, j, c), CARNIVORE);
+    }
+}
+
+// Acción del herbívoro vivo en (i, j), leyendo el estado actual (y, con radio
+// de percepción, el campo; ver CAMPO)
+EN_LINEA uint8_t elegir_herbivoro(const Mundo *m, const Reglas *rg, int i, int j, Celda c, const Vecindad *v) {
+    // 2-3. Huir de carnívoros (prioridad máxima) hacia una celda vacía que no
+    // tenga carnívoros cerca; con percepción, hacia donde se ven menos
+    if (v->carnivoro && v->seguro) {
+        if (rg->radio_percepcion > 0)
+            return proponer(ACCION_MUEVE, mirar_lejos(m, i, j, v->seguro, CARNIVORE, true, rg->radio_percepcion));
+        return proponer(ACCION_MUEVE, primera(v->seguro));
+    }
+
+    // 4. Comer plantas (si no huyó)
+    if (v->planta) return proponer(ACCION_COME, primera(v->planta));
+
+    // 5. Reproducirse (si no huyó ni comió, y tiene energía suficiente)
+    if (c.energia >= rg->energia_reproduccion && v->vacio)
+        return proponer(ACCION_REPRODUCE, primera(v->vacio));
+
+    // 6. Moverse hacia plantas: primero una celda vacía con plantas cerca;
+    // con percepción, hacia donde se ven más plantas; si no hay ninguna, la
+    // primera celda vacía (movimiento aleatorio)
+    if (v->cerca_planta) return proponer(ACCION_MUEVE, primera(v->cerca_planta));
+    if (rg->radio_percepcion > 0 && v->vacio) {
+        int d = mirar_lejos(m, i, j, v->vacio, PLANT, false, rg->radio_percepcion);
+        if (d >= 0) return proponer(ACCION_MUEVE, d);
+    }
+    if (v->vacio) return proponer(ACCION_MUEVE, primera(v->vacio));
+
+    // 7. Si no pudo hacer nada, permanece y envejece
+    return ACCION_NADA;
+}
+
+// Primera pasada de herbívoros: decide la acción del herbívoro en (i, j)
+EN_LINEA uint8_t decidir_herbivoro(const Mundo *m, const Reglas *rg, int i, int j, Celda c, const Vecindad *v) {
+    // 1. Muerte al inicio
+    if (muere(rg, c)) return ACCION_MUERE;
+    return elegir_herbivoro(m, rg, i, j, c, v);
+}
+
+// Segunda pasada de herbívoros: resuelve la propuesta del herbívoro en (i, j)
+EN_LINEA Resultado resolver_herbivoro(const Mundo *m, const Reglas *rg, int vecinos, int i, int j, Celda animal) {
+    size_t p = pos(m, i, j);
+    uint8_t prop = m->propuesta[p];
+    int accion = ACCION(prop);
+    Resultado r = {SIN_POSICION, animal, SIN_POSICION, 0, false};
+
+    if (accion == ACCION_MUERE) {
+        r.causa = causa_muerte(rg, animal);
+        return r;
+    }
+
+    int ti = i, tj = j;
+    if (accion >= ACCION_MUEVE) {
+        vecino(m, i, j, DIRECCION(prop), &ti, &tj);
+        INSTRUMENTAR(m, reclamos, 1);
+        if (!gana_destino(m, ti, tj, p, HERBIVORE, vecinos)) {
+            accion = ACCION_NADA;
+            INSTRUMENTAR(m, conflictos, 1);
+        }
+    }
+
+    r.destino = p;
+    switch (accion) {
+        case ACCION_COME:
+            r.come = true;
+            r.animal.energia += 1;          // Gana 1 energía
+            r.animal.ticks_sin_comer = 0;   // Resetea hambre
+            r.animal.edad++;
+            r.destino = pos(m, ti, tj);
+            break;
+        case ACCION_REPRODUCE:
+            r.cria = pos(m, ti, tj);
+            r.animal.energia -= 2;  // Costo de reproducción
+            r.animal.edad++;        // Envejece
+            break;
+        case ACCION_MUEVE:
+            r.animal.ticks_sin_comer++;
+            r.animal.edad++;
+            r.destino = pos(m, ti, tj);
+            break;
+        default:
+            r.animal.ticks_sin_comer++;
+            r.animal.edad++;
+    }
+
+    // 8. Pierde energía en la celda final
+    r.animal.energia--;
+    return r;
+}
+
+EN_LINEA void proponer_herbivoros_con(Mundo *m, int i, int k, const Reglas *rg, int vecinos) {
+    Mascaras *mk = &m->mascaras;
+    Direcciones vacio = direcciones(mk, mk->tipo[EMPTY], i, k, vecinos);
+    Direcciones planta = direcciones(mk, mk->tipo[PLANT], i, k, vecinos);
+    Direcciones carnivoro = direcciones(mk, mk->tipo[CARNIVORE], i, k, vecinos);
+    Direcciones seguro = direcciones(mk, mk->seguro, i, k, vecinos);
+    Direcciones cerca = direcciones(mk, mk->cerca_planta, i, k, vecinos);
+
+    for (uint64_t w = fila_mascara(mk, mk->tipo[HERBIVORE], i)[k]; w; w &= w - 1) {
+        int b = __builtin_ctzll(w);
+        int j = 64 * k + b;
+        size_t p = pos(m, i, j);
+        Vecindad v = {
+            .vacio = bits_celda(vacio, b, vecinos),
+            .planta = bits_celda(planta, b, vecinos),
+            .carnivoro = bits_celda(carnivoro, b, vecinos),
+            .seguro = bits_celda(seguro, b, vecinos),
+            .cerca_planta = bits_celda(cerca, b, vecinos),
+        };
+        m->propuesta[p] = decidir_herbivoro(m, rg, i, j, leer_celda(&m->ecosistema, p), &v);
+    }
+}
+
+EN_LINEA void aplicar_herbivoros_con(Mundo *m, int i, int k, const Reglas *rg, int vecinos) {
+    for (uint64_t w = fila_mascara(&m->mascaras, m->mascaras.tipo[HERBIVORE], i)[k]; w; w &= w - 1) {
+        int j = 64 * k + __builtin_ctzll(w);
+        Celda c = leer_celda(&m->ecosistema, pos(m, i, j));
+        escribir_resultado(m, rg, i, j, resolver_herbivoro(m, rg, vecinos, i, j, c), HERBIVORE);
+    }
+}
+
+// ------------------------------ AGENTES ------------------------------
+//
+// Con pocas celdas ocupadas recorrer la rejilla entera (máscaras, teselas,
+// filas sucias) cuesta más que los propios agentes. En modo disperso cada
+// especie es una lista compacta de agentes con su posición y sus campos, y el
+// plano de tipos (doble buffer, como siempre) queda solo como índice de
+// ocupación para consultar vecinos. Las reglas son las mismas: se decide con
+// las mismas funciones y se resuelve con el mismo protocolo de propuestas,
+// así que la firma es idéntica a la del modo denso. Cada fase cuesta
+// O(agentes): no se construyen máscaras y la reconciliación de buffers copia
+// solo las celdas de origen y destino de los agentes.
+//
+// La muerte por hambre, vejez o falta de energía se agenda: cada animal lleva
+// el tick en que vence si solo se mueve o se queda (cada tick pierde 1 de
+// energía y suma 1 de hambre y de edad), y se reprograma cuando come o cría,
+// que son las únicas acciones que cambian ese ritmo. Al compactar, los que
+// vencen en el tick siguiente van al final de la lista: la fase los retira
+// sin decidir nada por ellos, en O(muertes), y el resto decide sin mirar si
+// muere. Como las listas se rehacen en cada fase, la cola de vencimientos
+// solo necesita su primer cubo.
+
+static inline Agente agente(size_t p, Celda c) {
+    return (Agente) {
+        p,
+        (int8_t) saturar(c.energia, INT8_MIN, ENERGIA_MAXIMA),
+        (uint8_t) saturar(c.ticks_sin_comer, 0, UINT8_MAX),
+        (uint8_t) saturar(c.edad, 0, UINT8_MAX),
+        0,
+    };
+}
+
+static inline Celda celda_agente(const Agente *a, int especie) {
+    return (Celda) {especie, a->energia, a->ticks_sin_comer, a->edad};
+}
+
+// Tick en que vence el animal "a", cuyos campos valen al empezar "tick"
+static inline uint32_t vencimiento(const Reglas *rg, const Agente *a, long tick) {
+    int k = a->energia;
+    if (rg->max_ticks_sin_comer - a->ticks_sin_comer < k) k = rg->max_ticks_sin_comer - a->ticks_sin_comer;
+    if (rg->edad_maxima - a->edad < k) k = rg->edad_maxima - a->edad;
+    return (uint32_t) (tick + (k > 0 ? k : 0));
+}
+
+// ¿El animal "a" muere al empezar la fase de su especie del tick "tick"? Los
+// vencimientos caen a menos de 256 ticks, así que la resta no se confunde
+// cuando el contador da la vuelta.
+static inline bool vencido(const Agente *a, uint32_t tick) {
+    return (int32_t) (a->vence - tick) <= 0;
+}
+
+// Fin de los agentes vivos dentro de [desde, hasta): los vencidos están al
+// final de la lista
+static inline size_t corte_vivos(const Lista *l, size_t desde, size_t hasta) {
+    size_t vivos = l->n - l->vencidos;
+    return vivos < desde ? desde : vivos < hasta ? vivos : hasta;
+}
+
+static inline size_t bloques(size_t n) {
+    return (n + AGENTES_BLOQUE - 1) / AGENTES_BLOQUE;
+}
+
+// ¿Alguna celda vecina de (i, j) es del tipo dado?
+static inline int hay_vecino(const Mundo *m, int i, int j, int tipo, int vecinos) {
+    for (int d = 0; d < vecinos; d++) {
+        int ni, nj;
+        if (vecino(m, i, j, d, &ni, &nj) && m->ecosistema.tipo[pos(m, ni, nj)] == tipo) return 1;
+    }
+    return 0;
+}
+
+// Vecindad de (i, j) leída directamente del plano de tipos (el equivalente de
+// las máscaras del modo denso). "seguro" y "cerca_planta" solo las usan los
+// herbívoros, que las piden con "completa".
+static Vecindad vecindad_celda(const Mundo *m, int i, int j, bool completa, int vecinos) {
+    Vecindad v = {0};
+    for (int d = 0; d < vecinos; d++) {
+        int ni, nj;
+        if (!vecino(m, i, j, d, &ni, &nj)) continue;
+        unsigned bit = 1u << d;
+        switch (m->ecosistema.tipo[pos(m, ni, nj)]) {
+            case PLANT:     v.planta |= bit; break;
+            case HERBIVORE: v.herbivoro |= bit; break;
+            case CARNIVORE: v.carnivoro |= bit; break;
+            default:
+                v.vacio |= bit;
+                if (!completa) break;
+                if (!hay_vecino(m, ni, nj, CARNIVORE, vecinos)) v.seguro |= bit;
+                if (hay_vecino(m, ni, nj, PLANT, vecinos)) v.cerca_planta |= bit;
+        }
+    }
+    return v;
+}
+
+// Anota el resultado de un animal en el plano de tipos de "siguiente" y en sus
+// dos ranuras de salida (él mismo y su cría). "vence" es el vencimiento que
+// traía: solo se recalcula si comió o crió.
+EN_LINEA void anotar_resultado(Mundo *m, const Reglas *rg, size_t p, Resultado r, int especie, uint32_t vence,
+                               Agente *salida) {
+    uint8_t *tipo = m->siguiente.tipo;
+    salida[0].pos = salida[1].pos = SIN_POSICION;
+    contar_resultado(m, r, especie);
+
+    if (r.cria != SIN_POSICION) {
+        tipo[r.cria] = (uint8_t) especie;
+        salida[1] = (Agente) {r.cria, (int8_t) rg->energia_nuevo, 0, 0, 0};
+        salida[1].vence = vencimiento(rg, &salida[1], m->tick + 1);
+    }
+    if (r.destino != p) tipo[p] = EMPTY;
+    if (r.destino != SIN_POSICION) {
+        tipo[r.destino] = (uint8_t) especie;
+        salida[0] = agente(r.destino, r.animal);
+        salida[0].vence = r.come || r.cria != SIN_POSICION ? vencimiento(rg, &salida[0], m->tick + 1) : vence;
+    }
+}
+
+// Los animales vencidos de [desde, hasta) mueren sin decidir nada. Su
+// propuesta queda como muerte, así gana_destino no lee una de otro tick.
+EN_LINEA void retirar_vencidos(Mundo *m, const Reglas *rg, Lista *l, size_t desde, size_t hasta, int especie) {
+    Contadores *cont = contadores_hilo(m);
+    for (size_t n = desde; n < hasta; n++) {
+        size_t p = l->a[n].pos;
+        m->propuesta[p] = ACCION_MUERE;
+        m->siguiente.tipo[p] = EMPTY;
+        l->ranuras[2 * n].pos = l->ranuras[2 * n + 1].pos = SIN_POSICION;
+        cont->muertes[especie][causa_muerte(rg, celda_agente(&l->a[n], especie))]++;
+    }
+}
+
+// Kernel que procesa los agentes [desde, hasta) de una lista
+typedef void (*KernelAgentes)(Mundo *m, Lista *l, size_t desde, size_t hasta);
+
+typedef struct {
+    int especie;
+    KernelAgentes kernel;
+} TrabajoAgentes;
+
+// Como recorrer_activas, pero por bloques de AGENTES_BLOQUE agentes de las
+// listas. Lo deben llamar todos los hilos del equipo y termina con barrera.
+void recorrer_agentes(Mundo *m, const TrabajoAgentes *trabajos, int num_trabajos) {
+    size_t total = 0;
+    for (int t = 0; t < num_trabajos; t++) total += bloques(m->agentes[trabajos[t].especie].n);
+
+    #pragma omp for schedule(dynamic, 1) nowait
+    for (size_t b = 0; b < total; b++) {
+        const TrabajoAgentes *tr = trabajos;
+        size_t resto = b;
+        while (resto >= bloques(m->agentes[tr->especie].n)) resto -= bloques(m->agentes[tr++->especie].n);
+
+        Lista *l = &m->agentes[tr->especie];
+        size_t desde = resto * AGENTES_BLOQUE;
+        size_t hasta = desde + AGENTES_BLOQUE < l->n ? desde + AGENTES_BLOQUE : l->n;
+        INSTRUMENTAR(m, agentes, (long) (hasta - desde));
+        tr->kernel(m, l, desde, hasta);
+    }
+    barrera(m);
+}
+
+EN_LINEA void proponer_carnivoros_lista_con(Mundo *m, Lista *l, size_t desde, size_t hasta, const Reglas *rg, int vecinos) {
+    size_t corte = corte_vivos(l, desde, hasta);
+    for (size_t n = desde; n < corte; n++) {
+        size_t p = l->a[n].pos;
+        Vecindad v = vecindad_celda(m, (int) (p / m->ancho), (int) (p % m->ancho), false, vecinos);
+        m->propuesta[p] = elegir_carnivoro(rg, celda_agente(&l->a[n], CARNIVORE), &v);
+    }
+    retirar_vencidos(m, rg, l, corte, hasta, CARNIVORE);
+}
+
+EN_LINEA void aplicar_carnivoros_lista_con(Mundo *m, Lista *l, size_t desde, size_t hasta, const Reglas *rg, int vecinos) {
+    size_t corte = corte_vivos(l, desde, hasta);
+    for (size_t n = desde; n < corte; n++) {
+        size_t p = l->a[n].pos;
+        int i = (int) (p / m->ancho), j = (int) (p % m->ancho);
+        Resultado r = resolver_carnivoro(m, rg, vecinos, i, j, celda_agente(&l->a[n], CARNIVORE));
+        anotar_resultado(m, rg, p, r, CARNIVORE, l->a[n].vence, &l->ranuras[2 * n]);
+    }
+}
+
+EN_LINEA void proponer_herbivoros_lista_con(Mundo *m, Lista *l, size_t desde, size_t hasta, const Reglas *rg, int vecinos) {
+    size_t corte = corte_vivos(l, desde, hasta);
+    for (size_t n = desde; n < corte; n++) {
+        size_t p = l->a[n].pos;
+        int i = (int) (p / m->ancho), j = (int) (p % m->ancho);
+        Vecindad v = vecindad_celda(m, i, j, true, vecinos);
+        m->propuesta[p] = elegir_herbivoro(m, rg, i, j, celda_agente(&l->a[n], HERBIVORE), &v);
+    }
+    retirar_vencidos(m, rg, l, corte, hasta, HERBIVORE);
+}
+
+EN_LINEA void aplicar_herbivoros_lista_con(Mundo *m, Lista *l, size_t desde, size_t hasta, const Reglas *rg, int vecinos) {
+    size_t corte = corte_vivos(l, desde, hasta);
+    for (size_t n = desde; n < corte; n++) {
+        size_t p = l->a[n].pos;
+        int i = (int) (p / m->ancho), j = (int) (p % m->ancho);
+        Resultado r = resolver_herbivoro(m, rg, vecinos, i, j, celda_agente(&l->a[n], HERBIVORE));
+        anotar_resultado(m, rg, p, r, HERBIVORE, l->a[n].vence, &l->ranuras[2 * n]);
+    }
+}
+
+// Plantas en modo disperso: las mismas reglas que plantas_palabra, con
+// 1 + vecinos ranuras por planta (ella misma y una semilla por dirección).
+// Una celda sembrada por varias plantas solo la anota la primera que la toma.
+EN_LINEA void plantas_lista_con(Mundo *m, Lista *l, size_t desde, size_t hasta, const Reglas *rg, int vecinos) {
+    uint8_t *sig = m->siguiente.tipo;
+    Contadores *cont = contadores_hilo(m);
+    uint32_t umbral = UMBRAL_PCT(rg->prob_siembra);
+
+    for (size_t n = desde; n < hasta; n++) {
+        size_t p = l->a[n].pos;
+        int i = (int) (p / m->ancho), j = (int) (p % m->ancho);
+        Agente *salida = &l->ranuras[(1 + vecinos) * n];
+        for (int q = 0; q <= vecinos; q++) salida[q].pos = SIN_POSICION;
+
+        unsigned vecinos_V = vecindad_celda(m, i, j, false, vecinos).vacio;
+
+        // Muerte si no hay espacio
+        if (vecinos_V == 0) {
+            sig[p] = EMPTY;
+            cont->muertes[PLANT][CAUSA_SIN_ESPACIO]++;
+            continue;
+        }
+        salida[0] = l->a[n];
+
+        uint32_t sorteo[8];
+        sortear_siembra(m, p, vecinos, sorteo);
+        for (; vecinos_V; vecinos_V &= vecinos_V - 1) {
+            int d = primera(vecinos_V);
+            if (sorteo[d] >= umbral) continue;
+            int ni, nj;
+            vecino(m, i, j, d, &ni, &nj);
+            INSTRUMENTAR(m, reclamos, 1);
+            if (reclamada_por_carnivoro(m, ni, nj, vecinos)) {
+                INSTRUMENTAR(m, conflictos, 1);
+                continue;
+            }
+            size_t t = pos(m, ni, nj);
+            uint8_t vacia = EMPTY;
+            if (__atomic_compare_exchange_n(&sig[t], &vacia, PLANT, false,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                salida[1 + d] = (Agente) {t, 0, 0, 0, 0};
+                cont->nacimientos[PLANT]++;
+            } else {
+                INSTRUMENTAR(m, conflictos, 1);
+            }
+        }
+    }
+}
+
+// Cómo se compacta una lista al cerrar una fase: las especies que actuaron
+// dejan "por_agente" ranuras por agente; las presas (que no actuaron pero
+// pueden haber sido comidas) se filtran contra el plano de tipos.
+typedef struct {
+    int especie;
+    int por_agente;
+    bool presa;
+} Cierre;
+
+static inline void copiar_tipo(Mundo *m, size_t k) {
+    __atomic_store_n(&m->siguiente.tipo[k], m->ecosistema.tipo[k], __ATOMIC_RELAXED);
+}
+
+// Bloque de la lista combinada de cierres al que pertenece b
+static inline const Cierre *ubicar_cierre(const Mundo *m, const Cierre *s, size_t *b) {
+    while (*b >= bloques(m->agentes[s->especie].n)) *b -= bloques(m->agentes[s++->especie].n);
+    return s;
+}
+
+// Compacta las ranuras de las listas de "cierres" (con el orden de los
+// bloques, sin atómicos) y deja al final de cada lista de animales a los que
+// vencen en "tick". Las especies que actuaron además ponen al día el buffer
+// viejo copiando solo las celdas de origen y de destino de sus agentes. Lo
+// deben llamar todos los hilos del equipo.
+static void compactar_listas(Mundo *m, const Cierre *cierres, int num_cierres, long tick) {
+    uint32_t proximo = (uint32_t) tick;
+    size_t total = 0;
+    for (int s = 0; s < num_cierres; s++) total += bloques(m->agentes[cierres[s].especie].n);
+
+    size_t copiados = 0;
+    #pragma omp for schedule(dynamic, 1) nowait
+    for (size_t b = 0; b < total; b++) {
+        size_t resto = b;
+        const Cierre *s = ubicar_cierre(m, cierres, &resto);
+        Lista *l = &m->agentes[s->especie];
+        bool animal = s->especie != PLANT;
+        size_t desde = resto * AGENTES_BLOQUE;
+        size_t hasta = desde + AGENTES_BLOQUE < l->n ? desde + AGENTES_BLOQUE : l->n;
+        size_t validos = 0, vencen = 0;
+
+        for (size_t n = desde; n < hasta; n++) {
+            if (s->presa) {
+                Agente a = l->a[n];
+                if (m->ecosistema.tipo[a.pos] != s->especie) a.pos = SIN_POSICION;
+                l->ranuras[n] = a;
+                if (a.pos == SIN_POSICION) continue;
+                validos++;
+                vencen += animal && vencido(&a, proximo);
+                continue;
+            }
+            copiar_tipo(m, l->a[n].pos);
+            copiados++;
+            for (int q = 0; q < s->por_agente; q++) {
+                const Agente *a = &l->ranuras[n * s->por_agente + q];
+                if (a->pos == SIN_POSICION) continue;
+                copiar_tipo(m, a->pos);
+                copiados++;
+                validos++;
+                vencen += animal && vencido(a, proximo);
+            }
+        }
+        l->bloque[resto] = validos - vencen;
+        l->vencen[resto] = vencen;
+    }
+
+    #pragma omp atomic
+    m->bytes_tick += copiados;
+    barrera(m);
+
+    #pragma omp single
+    for (int s = 0; s < num_cierres; s++) {
+        Lista *l = &m->agentes[cierres[s].especie];
+        size_t acum = 0, acum_vencen = 0;
+        for (size_t b = 0; b < bloques(l->n); b++) {
+            size_t v = l->bloque[b], w = l->vencen[b];
+            l->bloque[b] = acum;
+            l->vencen[b] = acum_vencen;
+            acum += v;
+            acum_vencen += w;
+        }
+        l->validos = acum + acum_vencen;
+        l->vencidos = acum_vencen;
+    }
+
+    #pragma omp for schedule(dynamic, 1) nowait
+    for (size_t b = 0; b < total; b++) {
+        size_t resto = b;
+        const Cierre *s = ubicar_cierre(m, cierres, &resto);
+        Lista *l = &m->agentes[s->especie];
+        bool animal = s->especie != PLANT;
+        int r = s->presa ? 1 : s->por_agente;
+        size_t desde = resto * AGENTES_BLOQUE * r;
+        size_t hasta = (desde + AGENTES_BLOQUE * r < l->n * r) ? desde + AGENTES_BLOQUE * r : l->n * r;
+
+        Agente *destino = &l->a[l->bloque[resto]];
+        Agente *cola = &l->a[l->validos - l->vencidos + l->vencen[resto]];
+        for (size_t q = desde; q < hasta; q++) {
+            const Agente *a = &l->ranuras[q];
+            if (a->pos == SIN_POSICION) continue;
+            if (animal && vencido(a, proximo)) *cola++ = *a;
+            else *destino++ = *a;
+        }
+    }
+    barrera(m);
+
+    #pragma omp single
+    for (int s = 0; s < num_cierres; s++) m->agentes[cierres[s].especie].n = m->agentes[cierres[s].especie].validos;
+}
+
+// Cierra una fase en modo disperso: intercambia los planos de tipos y
+// compacta las listas para el tick siguiente. Lo deben llamar todos los hilos
+// del equipo.
+void intercambiar_disperso(Mundo *m, const Cierre *cierres, int num_cierres) {
+    #pragma omp single
+    {
+        reducir_contadores(m);
+        Planos tmp = m->ecosistema;
+        m->ecosistema = m->siguiente;
+        m->siguiente = tmp;
+    }
+    compactar_listas(m, cierres, num_cierres, m->tick + 1);
+}
+
+// Primer tick en modo disperso tras reunir las listas: agenda a cada animal
+// y aparta a los que vencen en este tick
+static void ordenar_vencidos(Mundo *m) {
+    for (int e = HERBIVORE; e <= CARNIVORE; e++) {
+        Lista *l = &m->agentes[e];
+        #pragma omp for schedule(static) nowait
+        for (size_t n = 0; n < l->n; n++) l->a[n].vence = vencimiento(&m->reglas, &l->a[n], m->tick);
+    }
+    barrera(m);
+
+    const Cierre animales[] = {{HERBIVORE, 1, true}, {CARNIVORE, 1, true}};
+    compactar_listas(m, animales, 2, m->tick);
+
+    #pragma omp single
+    m->ordenar_vencidos = false;
+}
+
+// Cierra el tramo de la fase "fase" que empezó en *t (solo mide el hilo 0;
+// todas las fases terminan en barrera, así que su reloj cubre al equipo). Con
+// la instrumentación, además cierra la fase de cada hilo.
+static inline void cronometrar(Mundo *m, int fase, double *t) {
+    cerrar_tramo(m, fase);
+    if (!m->medir || omp_get_thread_num() != 0) return;
+    double ahora = omp_get_wtime();
+    m->tiempo_fase[fase] += ahora - *t;
+    *t = ahora;
+}
+
+// Espacio para las listas durante un tick completo: cada herbívoro y
+// carnívoro puede dejar una cría y cada planta sembrar sus cuatro vecinos
+static int reservar_listas(Mundo *m, const long cuenta[4]) {
+    const int ranuras[4] = {0, 1 + m->topologia.vecinos, 2, 2};
+    for (int e = PLANT; e <= CARNIVORE; e++)
+        if (reservar_lista(&m->agentes[e], (size_t) cuenta[e] * ranuras[e], m->teselas.total) != 0)
+            return -1;
+    return 0;
+}
+
+// Paso de la rejilla a listas: las teselas (ya contadas) se recorren en orden
+// y cada una escribe sus agentes a partir de su desplazamiento
+static void reunir_agentes(Mundo *m) {
+    const Teselas *ts = &m->teselas;
+    const Mascaras *mk = &m->mascaras;
+
+    #pragma omp single
+    for (int e = PLANT; e <= CARNIVORE; e++) {
+        Lista *l = &m->agentes[e];
+        size_t acum = 0;
+        for (int t = 0; t < ts->total; t++) {
+            l->bloque[t] = acum;
+            acum += ts->conteo[e][t];
+        }
+        l->n = acum;
+        l->vencidos = 0;
+    }
+
+    #pragma omp for schedule(dynamic, 1)
+    for (int t = 0; t < ts->total; t++) {
+        int i0, i1, k0, k1;
+        limites_tesela(m, t, &i0, &i1, &k0, &k1);
+        for (int e = PLANT; e <= CARNIVORE; e++) {
+            Agente *out = &m->agentes[e].a[m->agentes[e].bloque[t]];
+            for (int i = i0; i < i1; i++) {
+                const uint64_t *fila = fila_mascara(mk, mk->tipo[e], i);
+                for (int k = k0; k < k1; k++)
+                    for (uint64_t w = fila[k]; w; w &= w - 1) {
+                        size_t p = pos(m, i, 64 * k + __builtin_ctzll(w));
+                        *out++ = agente(p, leer_celda(&m->ecosistema, p));
+                    }
+            }
+        }
+    }
+
+    #pragma omp single
+    {
+        m->disperso = true;
+        m->ordenar_vencidos = true;
+    }
+}
+
+static void volcar_bloque(Mundo *m, Lista *l, size_t desde, size_t hasta) {
+    for (size_t n = desde; n < hasta; n++) {
+        const Agente *a = &l->a[n];
+        for (Planos *pl = &m->ecosistema; pl; pl = pl == &m->ecosistema ? &m->siguiente : NULL) {
+            pl->energia[a->pos] = a->energia;
+            pl->ticks_sin_comer[a->pos] = a->ticks_sin_comer;
+            pl->edad[a->pos] = a->edad;
+        }
+    }
+}
+
+// Paso de listas a rejilla: los planos de tipos ya están al día; los demás se
+// limpian y se rellenan con los campos de los agentes en ambos buffers
+static void volcar_agentes(Mundo *m) {
+    #pragma omp for schedule(static)
+    for (int i = 0; i < m->alto; i++) {
+        size_t k = pos(m, i, 0);
+        for (int p = 1; p < BYTES_CELDA; p++) {
+            memset(m->ecosistema.tipo + p * m->celdas + k, 0, m->ancho);
+            memset(m->siguiente.tipo + p * m->celdas + k, 0, m->ancho);
+        }
+    }
+
+    const TrabajoAgentes volcar[] = {
+        {PLANT, volcar_bloque}, {HERBIVORE, volcar_bloque}, {CARNIVORE, volcar_bloque},
+    };
+    recorrer_agentes(m, volcar, 3);
+
+    #pragma omp single
+    m->disperso = false;
+    construir_mascaras(m);
+}
+
+// Elige la representación para el siguiente tick según la ocupación medida,
+// con histéresis para no alternar en cada tick cerca del umbral. Si no hay
+// memoria para las listas se sigue (o se vuelve) en modo denso. Lo deben
+// llamar todos los hilos del equipo.
+void ajustar_modo(Mundo *m) {
+    #pragma omp single
+    {
+        const long *cuenta = m->poblacion;
+        double ocupacion = (double) (cuenta[PLANT] + cuenta[HERBIVORE] + cuenta[CARNIVORE]) / m->celdas;
+
+        bool disperso = m->modo == MODO_DISPERSO;
+        if (m->modo == MODO_AUTO)
+            disperso = m->disperso ? ocupacion <= OCUPACION_DENSO / 100.0
+                                   : ocupacion < OCUPACION_DISPERSO / 100.0;
+        if (disperso && reservar_listas(m, cuenta) != 0) disperso = false;
+        m->cambiar_modo = disperso != m->disperso;
+    }
+
+    if (!m->cambiar_modo) return;
+    if (m->disperso) volcar_agentes(m);
+    else reunir_agentes(m);
+}
+
+// ------------------------------- NÚCLEOS -------------------------------
+//
+// Las reglas se fijan al ejecutar, pero los núcleos del tick también se
+// generan especializados para los juegos de reglas más usados: cada versión
+// llama al núcleo genérico (siempre en línea) con un Reglas constante, y el
+// compilador pliega los umbrales como cuando eran #define. Cada fase elige
+// la versión cuyas reglas coinciden con las del mundo o, si no hay, la
+// genérica, que las lee de m->reglas. Cada juego (y la genérica) se genera
+// dos veces, para vecindad de 4 y de 8, así el número de direcciones también
+// es una constante dentro del núcleo. Para especializar otros juegos sin
+// tocar el código:
+//
+//   gcc ... -D'REGLAS_EXTRA(X)=X(largas, 5, 2, 2, 20, 30, 0)'
+
+#ifndef REGLAS_EXTRA
+#define REGLAS_EXTRA(X)
+#endif
+
+// Nombre y valores (en el orden de Reglas) de cada versión especializada
+#define REGLAS_ESPECIALIZADAS(X)        \
+    X(base, VALORES_REGLAS_BASE)        \
+    REGLAS_EXTRA(X)
+
+typedef struct {
+    const char *nombre;
+    const Reglas *reglas;       // NULL en la genérica
+    int vecinos;
+    KernelPalabra proponer_herbivoros, aplicar_herbivoros;
+    KernelPalabra proponer_carnivoros, aplicar_carnivoros, plantas_palabra;
+    KernelAgentes proponer_herbivoros_lista, aplicar_herbivoros_lista;
+    KernelAgentes proponer_carnivoros_lista, aplicar_carnivoros_lista, plantas_lista;
+} Nucleos;
+
+#define NUCLEO_PALABRA(nucleo, nombre, rg, v) \
+    static void nucleo##_##nombre##_##v(Mundo *m, int i, int k) { nucleo##_con(m, i, k, rg, v); }
+#define NUCLEO_AGENTES(nucleo, nombre, rg, v)                                       \
+    static void nucleo##_##nombre##_##v(Mundo *m, Lista *l, size_t desde, size_t hasta) { \
+        nucleo##_con(m, l, desde, hasta, rg, v);                                    \
+    }
+
+#define DEFINIR_VECINDAD(nombre, rg, v)                         \
+    NUCLEO_PALABRA(proponer_herbivoros, nombre, rg, v)          \
+    NUCLEO_PALABRA(aplicar_herbivoros, nombre, rg, v)           \
+    NUCLEO_PALABRA(proponer_carnivoros, nombre, rg, v)          \
+    NUCLEO_PALABRA(aplicar_carnivoros, nombre, rg, v)           \
+    NUCLEO_PALABRA(plantas_palabra, nombre, rg, v)              \
+    NUCLEO_AGENTES(proponer_herbivoros_lista, nombre, rg, v)    \
+    NUCLEO_AGENTES(aplicar_herbivoros_lista, nombre, rg, v)     \
+    NUCLEO_AGENTES(proponer_carnivoros_lista, nombre, rg, v)    \
+    NUCLEO_AGENTES(aplicar_carnivoros_lista, nombre, rg, v)     \
+    NUCLEO_AGENTES(plantas_lista, nombre, rg, v)
+
+#define DEFINIR_NUCLEOS(nombre, rg) \
+    DEFINIR_VECINDAD(nombre, rg, 4) \
+    DEFINIR_VECINDAD(nombre, rg, 8)
+
+#define ENTRADA_VECINDAD(nombre, rg, v) {                                               \
+    #nombre, rg, v,                                                                     \
+    proponer_herbivoros_##nombre##_##v, aplicar_herbivoros_##nombre##_##v,              \
+    proponer_carnivoros_##nombre##_##v, aplicar_carnivoros_##nombre##_##v,              \
+    plantas_palabra_##nombre##_##v,                                                     \
+    proponer_herbivoros_lista_##nombre##_##v, aplicar_herbivoros_lista_##nombre##_##v,  \
+    proponer_carnivoros_lista_##nombre##_##v, aplicar_carnivoros_lista_##nombre##_##v,  \
+    plantas_lista_##nombre##_##v,                                                       \
+}
+
+#define ENTRADA_NUCLEOS(nombre, rg) ENTRADA_VECINDAD(nombre, rg, 4), ENTRADA_VECINDAD(nombre, rg, 8)
+
+#define ESPECIALIZAR(nombre, ...)                               \
+    static const Reglas reglas_##nombre = {__VA_ARGS__};        \
+    DEFINIR_NUCLEOS(nombre, &reglas_##nombre)
+#define ENTRADA_ESPECIALIZADA(nombre, ...) ENTRADA_NUCLEOS(nombre, &reglas_##nombre),
+
+REGLAS_ESPECIALIZADAS(ESPECIALIZAR)
+DEFINIR_NUCLEOS(generico, &m->reglas)
+
+static const Nucleos NUCLEOS[] = {
+    REGLAS_ESPECIALIZADAS(ENTRADA_ESPECIALIZADA)
+    ENTRADA_NUCLEOS(generico, NULL),   // Siempre las dos últimas
+};
+#define NUM_NUCLEOS (sizeof(NUCLEOS) / sizeof(NUCLEOS[0]))
+
+// La versión más rápida para unas reglas y una vecindad: la especializada si
+// la hay
+static const Nucleos *elegir_nucleos(const Reglas *rg, int vecinos) {
+    for (size_t n = 0; n + 2 < NUM_NUCLEOS; n++)
+        if (NUCLEOS[n].vecinos == vecinos && memcmp(NUCLEOS[n].reglas, rg, sizeof(Reglas)) == 0)
+            return &NUCLEOS[n];
+    return &NUCLEOS[vecinos == 8 ? NUM_NUCLEOS - 1 : NUM_NUCLEOS - 2];
+}
+
+void herbivore_update(Mundo *m) {
+    const Nucleos *nu = elegir_nucleos(&m->reglas, m->topologia.vecinos);
+    const Trabajo proponer[] = {{HERBIVORE, nu->proponer_herbivoros}};
+    recorrer_activas(m, proponer, 1, m->seleccion[0]);
+
+    const Trabajo aplicar[] = {{HERBIVORE, nu->aplicar_herbivoros}};
+    recorrer_activas(m, aplicar, 1, m->seleccion[1]);
+}
+
+// Plantas y carnívoros leen el mismo estado (el que dejan los herbívoros) y
+// escriben en el mismo "siguiente" sin pisarse: los carnívoros solo escriben
+// su celda y el destino que ganaron, las plantas su celda y vecinos vacíos no
+// reclamados. Las dos especies comparten un solo reparto de teselas.
+void plant_carnivore_update(Mundo *m) {
+    const Nucleos *nu = elegir_nucleos(&m->reglas, m->topologia.vecinos);
+    const Trabajo proponer[] = {{CARNIVORE, nu->proponer_carnivoros}};
+    recorrer_activas(m, proponer, 1, m->seleccion[0]);
+
+    const Trabajo aplicar[] = {{CARNIVORE, nu->aplicar_carnivoros}, {PLANT, nu->plantas_palabra}};
+    recorrer_activas(m, aplicar, 2, m->seleccion[1]);
+}
+
+// Un tick en modo disperso, con las mismas fases que el denso
+static void avanzar_tick_disperso(Mundo *m, double *t) {
+    const Nucleos *nu = elegir_nucleos(&m->reglas, m->topologia.vecinos);
+    if (m->ordenar_vencidos) {
+        ordenar_vencidos(m);
+        cronometrar(m, FASE_MODO, t);
+    }
+    const TrabajoAgentes proponer_h[] = {{HERBIVORE, nu->proponer_herbivoros_lista}};
+    recorrer_agentes(m, proponer_h, 1);
+    const TrabajoAgentes aplicar_h[] = {{HERBIVORE, nu->aplicar_herbivoros_lista}};
+    recorrer_agentes(m, aplicar_h, 1);
+    cronometrar(m, FASE_HERBIVOROS, t);
+    const Cierre fase_h[] = {{HERBIVORE, 2, false}, {PLANT, 1, true}};
+    intercambiar_disperso(m, fase_h, 2);
+    cronometrar(m, FASE_INTERCAMBIO, t);
+
+    const TrabajoAgentes proponer_c[] = {{CARNIVORE, nu->proponer_carnivoros_lista}};
+    recorrer_agentes(m, proponer_c, 1);
+    const TrabajoAgentes aplicar_pc[] = {{CARNIVORE, nu->aplicar_carnivoros_lista}, {PLANT, nu->plantas_lista}};
+    recorrer_agentes(m, aplicar_pc, 2);
+    cronometrar(m, FASE_PLANTAS_CARNIVOROS, t);
+    const Cierre fase_pc[] = {{CARNIVORE, 2, false}, {PLANT, 1 + m->topologia.vecinos, false}, {HERBIVORE, 1, true}};
+    intercambiar_disperso(m, fase_pc, 3);
+    cronometrar(m, FASE_INTERCAMBIO, t);
+}
+
+// Un tick completo: herbívoros primero, luego plantas y carnívoros juntos, y
+// la elección de representación para el siguiente. Lo deben llamar todos los
+// hilos de un único equipo (sin paralelismo anidado); cada pasada termina en
+// una barrera.
+void avanzar_tick(Mundo *m) {
+    double t = m->medir ? omp_get_wtime() : 0;
+    abrir_tramo(m);
+
+    if (m->reglas.radio_percepcion > 0) {
+        actualizar_campo(m);
+        cronometrar(m, FASE_MASCARAS, &t);
+    }
+    if (m->disperso) {
+        avanzar_tick_disperso(m, &t);
+    } else {
+        herbivore_update(m);
+        cronometrar(m, FASE_HERBIVOROS, &t);
+        intercambiar_buffers(m);
+        cronometrar(m, FASE_INTERCAMBIO, &t);
+        actualizar_mascaras(m);
+        cronometrar(m, FASE_MASCARAS, &t);
+
+        plant_carnivore_update(m);
+        cronometrar(m, FASE_PLANTAS_CARNIVOROS, &t);
+        intercambiar_buffers(m);
+        cronometrar(m, FASE_INTERCAMBIO, &t);
+        actualizar_mascaras(m);
+        cronometrar(m, FASE_MASCARAS, &t);
+    }
+    ajustar_modo(m);
+    cronometrar(m, FASE_MODO, &t);
+}
+
+// ------------------------------ ESCRITOR ------------------------------
+//
+// Hilo de fondo (fuera del equipo de OpenMP) que hace la E/S lenta mientras
+// la simulación sigue. Recibe una tarea a la vez: encargar espera a que
+// termine la anterior, así quien le pasa un buffer sabe que el anterior ya
+// quedó libre.
+
+typedef void (*TareaEscritor)(void *arg);
+
+typedef struct {
+    pthread_t hilo;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    TareaEscritor tarea;    // Tarea pendiente o en curso, NULL si está libre
+    void *arg;
+    bool terminar;
+    bool activo;            // Se creó el hilo
+} Escritor;
+
+static void *bucle_escritor(void *arg) {
+    Escritor *e = arg;
+    pthread_mutex_lock(&e->mutex);
+    for (;;) {
+        while (e->tarea == NULL && !e->terminar) pthread_cond_wait(&e->cond, &e->mutex);
+        if (e->tarea == NULL) break;
+
+        TareaEscritor tarea = e->tarea;
+        pthread_mutex_unlock(&e->mutex);
+        tarea(e->arg);
+        pthread_mutex_lock(&e->mutex);
+
+        e->tarea = NULL;
+        pthread_cond_broadcast(&e->cond);
+    }
+    pthread_mutex_unlock(&e->mutex);
+    return NULL;
+}
+
+int iniciar_escritor(Escritor *e) {
+    e->tarea = NULL;
+    e->terminar = false;
+    pthread_mutex_init(&e->mutex, NULL);
+    pthread_cond_init(&e->cond, NULL);
+    e->activo = pthread_create(&e->hilo, NULL, bucle_escritor, e) == 0;
+    return e->activo ? 0 : -1;
+}
+
+// Espera a que el escritor quede libre
+void esperar_escritor(Escritor *e) {
+    if (!e->activo) return;
+    pthread_mutex_lock(&e->mutex);
+    while (e->tarea != NULL) pthread_cond_wait(&e->cond, &e->mutex);
+    pthread_mutex_unlock(&e->mutex);
+}
+
+// Le pasa una tarea al escritor (esperando a que termine la anterior). Sin
+// hilo de fondo la tarea se hace en el acto.
+void encargar(Escritor *e, TareaEscritor tarea, void *arg) {
+    if (!e->activo) {
+        tarea(arg);
+        return;
+    }
+    pthread_mutex_lock(&e->mutex);
+    while (e->tarea != NULL) pthread_cond_wait(&e->cond, &e->mutex);
+    e->tarea = tarea;
+    e->arg = arg;
+    pthread_cond_broadcast(&e->cond);
+    pthread_mutex_unlock(&e->mutex);
+}
+
+// Termina la tarea pendiente y cierra el hilo
+void detener_escritor(Escritor *e) {
+    if (!e->activo) return;
+    pthread_mutex_lock(&e->mutex);
+    e->terminar = true;
+    pthread_cond_broadcast(&e->cond);
+    pthread_mutex_unlock(&e->mutex);
+    pthread_join(e->hilo, NULL);
+    pthread_mutex_destroy(&e->mutex);
+    pthread_cond_destroy(&e->cond);
+    e->activo = false;
+}
+
+// ----------------------------- CHECKPOINT -----------------------------
+//
+// Formato binario versionado (en el orden de bytes de la máquina):
+//
+//   [0, CHK_DATOS)   cabecera (CabeceraChk, el resto en cero)
+//   sin comprimir:   los cuatro planos seguidos, celdas bytes cada uno, tal
+//                    como están en memoria
+//   comprimido:      índice de (teselas + 1) desplazamientos uint64 relativos
+//                    al inicio del índice, y luego cada tesela con sus cuatro
+//                    planos (fila por fila) en RLE de pares (repeticiones, valor)
+//
+// El estado del generador es solo (semilla, tick), que van en la cabecera
+// junto con las reglas y la topología de la corrida.
+// La cabecera ocupa una página, así los planos quedan alineados en el archivo
+// mapeado y restaurar no necesita parsear nada: se copian (o se descomprimen
+// por teselas, en paralelo) directo desde el mapeo.
+
+#define CHK_MAGICO "ECOCHK\r\n"
+#define CHK_VERSION 4   // 2: con las reglas; 3: con la topología; 4: con el radio de percepción
+#define CHK_DATOS 4096
+#define CHK_COMPRIMIDO 1u
+
+typedef struct {
+    char magico[8];
+    uint32_t version;
+    uint32_t banderas;      // CHK_COMPRIMIDO
+    int32_t ancho;
+    int32_t alto;
+    int64_t tick;
+    uint64_t semilla;
+    uint64_t bytes;         // Datos después de la cabecera
+    int32_t tesela_filas;   // Geometría de las teselas del formato comprimido
+    int32_t tesela_columnas;
+    Reglas reglas;
+    int32_t vecinos;        // 4 u 8
+    int32_t toroide;        // 1 si los bordes dan la vuelta
+} CabeceraChk;
+
+// Checkpoint periódico: una copia del estado que el escritor vuelca a disco
+// mientras la simulación sigue
+typedef struct {
+    int cada;               // Ticks entre checkpoints (0: desactivado)
+    const char *ruta;
+    bool comprimir;
+    Planos planos;          // Copia del estado (solo la toca el escritor mientras escribe)
+    size_t celdas;
+    CabeceraChk cabecera;
+} Checkpoint;
+
+// Celdas [j0, j1) de las filas [i0, i1) que cubre la tesela t del archivo
+static void tesela_chk(const CabeceraChk *c, int t, int *i0, int *i1, int *j0, int *j1) {
+    int columnas = (c->ancho + c->tesela_columnas - 1) / c->tesela_columnas;
+    *i0 = (t / columnas) * c->tesela_filas;
+    *i1 = *i0 + c->tesela_filas < c->alto ? *i0 + c->tesela_filas : c->alto;
+    *j0 = (t % columnas) * c->tesela_columnas;
+    *j1 = *j0 + c->tesela_columnas < c->ancho ? *j0 + c->tesela_columnas : c->ancho;
+}
+
+static int teselas_chk(const CabeceraChk *c) {
+    return ((c->alto + c->tesela_filas - 1) / c->tesela_filas) *
+           ((c->ancho + c->tesela_columnas - 1) / c->tesela_columnas);
+}
+
+// Comprime una tesela de los cuatro planos en "out" y devuelve los bytes escritos
+static size_t comprimir_tesela(const CabeceraChk *c, const uint8_t *planos, size_t celdas, int t, uint8_t *out) {
+    int i0, i1, j0, j1;
+    tesela_chk(c, t, &i0, &i1, &j0, &j1);
+    size_t n = 0;
+    int repeticiones = 0;
+    uint8_t valor = 0;
+
+    for (int p = 0; p < BYTES_CELDA; p++)
+        for (int i = i0; i < i1; i++) {
+            const uint8_t *fila = planos + p * celdas + (size_t) i * c->ancho;
+            for (int j = j0; j < j1; j++) {
+                if (repeticiones > 0 && (fila[j] != valor || repeticiones == 255)) {
+                    out[n++] = (uint8_t) repeticiones;
+                    out[n++] = valor;
+                    repeticiones = 0;
+                }
+                valor = fila[j];
+                repeticiones++;
+            }
+        }
+    if (repeticiones > 0) {
+        out[n++] = (uint8_t) repeticiones;
+        out[n++] = valor;
+    }
+    return n;
+}
+
+// Inversa de comprimir_tesela; -1 si el flujo no alcanza o sobra
+static int descomprimir_tesela(const CabeceraChk *c, const uint8_t *in, size_t bytes, uint8_t *planos, size_t celdas, int t) {
+    int i0, i1, j0, j1;
+    tesela_chk(c, t, &i0, &i1, &j0, &j1);
+    size_t n = 0;
+    int repeticiones = 0;
+    uint8_t valor = 0;
+
+    for (int p = 0; p < BYTES_CELDA; p++)
+        for (int i = i0; i < i1; i++) {
+            uint8_t *fila = planos + p * celdas + (size_t) i * c->ancho;
+            for (int j = j0; j < j1; j++) {
+                if (repeticiones == 0) {
+                    if (n + 2 > bytes) return -1;
+                    repeticiones = in[n++];
+                    valor = in[n++];
+                    if (repeticiones == 0) return -1;
+                }
+                fila[j] = valor;
+                repeticiones--;
+            }
+        }
+    return repeticiones == 0 && n == bytes ? 0 : -1;
+}
+
+// Tarea del escritor: guarda la copia en "ruta.tmp" y la renombra al final,
+// así un corte a mitad de escritura deja intacto el checkpoint anterior
+static void escribir_checkpoint(void *arg) {
+    Checkpoint *chk = arg;
+    CabeceraChk *c = &chk->cabecera;
+    const uint8_t *planos = chk->planos.tipo;
+    size_t crudo = chk->celdas * BYTES_CELDA;
+
+    uint8_t *datos = (uint8_t *) planos;
+    uint8_t *comprimido = NULL;
+    c->bytes = crudo;
+    if (chk->comprimir) {
+        int teselas = teselas_chk(c);
+        size_t indice = (size_t) (teselas + 1) * sizeof(uint64_t);
+        comprimido = malloc(indice + 2 * crudo);
+        if (comprimido != NULL) {
+            uint64_t *desp = (uint64_t *) comprimido;
+            size_t n = indice;
+            for (int t = 0; t < teselas; t++) {
+                desp[t] = n;
+                n += comprimir_tesela(c, planos, chk->celdas, t, comprimido + n);
+            }
+            desp[teselas] = n;
+            datos = comprimido;
+            c->bytes = n;
+            c->banderas |= CHK_COMPRIMIDO;
+        }
+    }
+
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", chk->ruta);
+    uint8_t pagina[CHK_DATOS] = {0};
+    memcpy(pagina, c, sizeof(*c));
+
+    FILE *f = fopen(tmp, "wb");
+    int ok = f != NULL &&
+             fwrite(pagina, 1, CHK_DATOS, f) == CHK_DATOS &&
+             fwrite(datos, 1, c->bytes, f) == c->bytes;
+    if (f != NULL) {
+        ok &= fflush(f) == 0 && fsync(fileno(f)) == 0;
+        ok &= fclose(f) == 0;
+    }
+    if (ok) ok = rename(tmp, chk->ruta) == 0;
+    if (!ok) fprintf(stderr, "No se pudo escribir el checkpoint %s\n", chk->ruta);
+    free(comprimido);
+}
+
+int crear_checkpoint(Checkpoint *chk, const Mundo *m) {
+    chk->celdas = m->celdas;
+    chk->planos.tipo = NULL;
+    return chk->cada > 0 ? reservar_planos(&chk->planos, m->ancho, m->celdas, NULL) : 0;
+}
+
+void destruir_checkpoint(Checkpoint *chk) {
+    if (chk->planos.tipo != NULL) liberar_planos(&chk->planos, chk->celdas);
+}
+
+// Copia el estado actual en "destino" (en modo disperso arma los planos desde
+// las listas). Lo deben llamar todos los hilos del equipo.
+void copiar_estado(const Mundo *m, Planos *destino) {
+    #pragma omp for schedule(static)
+    for (int i = 0; i < m->alto; i++) {
+        size_t k = pos(m, i, 0);
+        memcpy(destino->tipo + k, m->ecosistema.tipo + k, m->ancho);
+        for (int p = 1; p < BYTES_CELDA; p++) {
+            if (m->disperso) memset(destino->tipo + p * m->celdas + k, 0, m->ancho);
+            else memcpy(destino->tipo + p * m->celdas + k, m->ecosistema.tipo + p * m->celdas + k, m->ancho);
+        }
+    }
+    if (!m->disperso) return;
+
+    for (int e = HERBIVORE; e <= CARNIVORE; e++) {
+        const Lista *l = &m->agentes[e];
+        #pragma omp for schedule(static)
+        for (size_t n = 0; n < l->n; n++) {
+            const Agente *a = &l->a[n];
+            destino->energia[a->pos] = a->energia;
+            destino->ticks_sin_comer[a->pos] = a->ticks_sin_comer;
+            destino->edad[a->pos] = a->edad;
+        }
+    }
+}
+
+// Toma un checkpoint del estado al final del tick: el equipo copia el estado
+// y el escritor lo guarda en segundo plano. Lo deben llamar todos los hilos.
+void guardar_checkpoint(Mundo *m, Checkpoint *chk, Escritor *escritor) {
+    // La copia anterior tiene que haber terminado de escribirse
+    #pragma omp single
+    esperar_escritor(escritor);
+
+    copiar_estado(m, &chk->planos);
+
+    #pragma omp single
+    {
+        chk->cabecera = (CabeceraChk) {
+            .version = CHK_VERSION,
+            .ancho = m->ancho,
+            .alto = m->alto,
+            .tick = m->tick,
+            .semilla = m->semilla,
+            .tesela_filas = TESELA_FILAS,
+            .tesela_columnas = 64 * TESELA_PALABRAS,
+            .reglas = m->reglas,
+            .vecinos = m->topologia.vecinos,
+            .toroide = m->topologia.envolver_filas,
+        };
+        memcpy(chk->cabecera.magico, CHK_MAGICO, sizeof(chk->cabecera.magico));
+        encargar(escritor, escribir_checkpoint, chk);
+    }
+}
+
+// Lee la cabecera de un checkpoint de esta versión o de una anterior. Las
+// anteriores tienen los mismos campos hasta la geometría de las teselas y
+// luego menos: la 1 no tiene reglas, la 2 no tiene topología y la 2 y la 3
+// tienen las reglas sin el radio. Lo que falta toma el valor que tenía toda
+// corrida de entonces (REGLAS_BASE, bordes y 4 vecinos, radio 0). Devuelve
+// false si la versión es desconocida o más nueva.
+static bool leer_cabecera(const uint8_t *archivo, CabeceraChk *c) {
+    memcpy(c, archivo, sizeof(*c));
+    if (c->version == CHK_VERSION) return true;
+    if (c->version < 1 || c->version > CHK_VERSION) return false;
+
+    const uint8_t *resto = archivo + offsetof(CabeceraChk, reglas);
+    size_t bytes_reglas = offsetof(Reglas, radio_percepcion);
+    c->reglas = REGLAS_BASE;
+    c->vecinos = 4;
+    c->toroide = 0;
+    if (c->version >= 2) memcpy(&c->reglas, resto, bytes_reglas);
+    if (c->version >= 3) {
+        memcpy(&c->vecinos, resto + bytes_reglas, sizeof(c->vecinos));
+        memcpy(&c->toroide, resto + bytes_reglas + sizeof(c->vecinos), sizeof(c->toroide));
+    }
+    return true;
+}
+
+// Crea el mundo a partir de un checkpoint (dimensiones, tick, semilla, reglas
+// y topología incluidos), fuera de memoria si se da un directorio. Devuelve -1
+// con un mensaje si el archivo no sirve.
+int restaurar_checkpoint(Mundo *m, const char *ruta, const char *disco, size_t presupuesto) {
+    int fd = open(ruta, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "No se pudo abrir el checkpoint %s\n", ruta);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    size_t bytes = (size_t) st.st_size;
+    const uint8_t *archivo = bytes >= CHK_DATOS
+        ? mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (archivo == MAP_FAILED) {
+        fprintf(stderr, "Checkpoint inválido: %s\n", ruta);
+        return -1;
+    }
+
+    CabeceraChk c;
+    const uint8_t *datos = archivo + CHK_DATOS;
+    int valido = leer_cabecera(archivo, &c) && memcmp(c.magico, CHK_MAGICO, sizeof(c.magico)) == 0;
+    size_t celdas = (size_t) c.ancho * c.alto;
+    valido = valido && c.ancho > 0 && c.alto > 0 && c.tick >= 0 &&
+             c.tesela_filas > 0 && c.tesela_columnas > 0 && reglas_validas(&c.reglas) &&
+             (c.vecinos == 4 || c.vecinos == 8) && (c.toroide == 0 || c.toroide == 1) &&
+             c.bytes <= bytes - CHK_DATOS &&
+             ((c.banderas & CHK_COMPRIMIDO) || c.bytes == celdas * BYTES_CELDA);
+    if (!valido) {
+        fprintf(stderr, "Checkpoint inválido o de otra versión: %s\n", ruta);
+        munmap((void *) archivo, bytes);
+        return -1;
+    }
+    if (crear_mundo(m, c.ancho, c.alto, disco, presupuesto) != 0) {
+        fprintf(stderr, "Sin memoria para un ecosistema de %dx%d\n", c.ancho, c.alto);
+        munmap((void *) archivo, bytes);
+        return -1;
+    }
+    m->tick = c.tick;
+    m->semilla = c.semilla;
+    m->reglas = c.reglas;
+    fijar_topologia(m, c.toroide, c.toroide, c.vecinos);
+
+    int errores = 0;
+    if (c.banderas & CHK_COMPRIMIDO) {
+        int teselas = teselas_chk(&c);
+        const uint64_t *desp = (const uint64_t *) datos;
+        // El índice se revisa entero antes de descomprimir: cada tesela debe
+        // caer entre el final del índice y el final de los datos
+        size_t indice = (size_t) (teselas + 1) * sizeof(uint64_t);
+        if (indice > c.bytes || desp[0] < indice) errores = 1;
+        for (int t = 0; t < teselas && !errores; t++)
+            if (desp[t] > desp[t + 1] || desp[t + 1] > c.bytes) errores = 1;
+        if (errores) teselas = 0;
+        #pragma omp parallel for schedule(dynamic, 1) reduction(+:errores)
+        for (int t = 0; t < teselas; t++) {
+            errores += descomprimir_tesela(&c, datos + desp[t], desp[t + 1] - desp[t],
+                                           m->ecosistema.tipo, celdas, t) != 0;
+        }
+    } else {
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < c.alto; i++)
+            for (int p = 0; p < BYTES_CELDA; p++) {
+                size_t k = p * celdas + (size_t) i * c.ancho;
+                memcpy(m->ecosistema.tipo + k, datos + k, c.ancho);
+            }
+    }
+    munmap((void *) archivo, bytes);
+
+    if (errores) {
+        fprintf(stderr, "Checkpoint dañado: %s\n", ruta);
+        destruir_mundo(m);
+        return -1;
+    }
+    memcpy(m->siguiente.tipo, m->ecosistema.tipo, celdas * BYTES_CELDA);
+    return 0;
+}
+
+// ------------------------------- SALIDA -------------------------------
+//
+// La salida no se imprime desde el equipo: cada "cada" ticks el equipo arma
+// el cuadro completo en un buffer (en paralelo, por filas) y se lo pasa al
+// escritor, que lo vuelca con un solo fwrite mientras la simulación sigue.
+// Hay dos buffers que se alternan: mientras uno se escribe el otro se llena.
+// El resumen de poblaciones va siempre a stdout; el cuadro va a "ruta".
+//
+//   ascii     la rejilla en texto, como siempre
+//   binario   flujo de cuadros: CabeceraCuadro y la rejilla a 2 bits por
+//             celda (4 celdas por byte, fila por fila)
+//   ppm, pgm  una imagen PNM por cuadro, concatenadas (color o grises)
+//   resumen   solo el resumen de poblaciones
+//   ninguna   nada
+
+#define SALIDA_ASCII    0
+#define SALIDA_BINARIO  1
+#define SALIDA_PPM      2
+#define SALIDA_PGM      3
+#define SALIDA_RESUMEN  4
+#define SALIDA_NINGUNA  5
+
+static const char *const NOMBRES_SALIDA[] = {"ascii", "binario", "ppm", "pgm", "resumen", "ninguna"};
+static const char *const RUTAS_SALIDA[] = {NULL, "ecosistema.bin", "ecosistema.ppm", "ecosistema.pgm", NULL, NULL};
+
+#define CUADRO_MAGICO "ECOF"
+
+typedef struct {
+    char magico[4];
+    uint32_t ancho;
+    uint32_t alto;
+    uint32_t bytes_fila;    // ceil(ancho / 4)
+    int64_t tick;
+} CabeceraCuadro;
+
+struct Salida;
+
+typedef struct {
+    struct Salida *salida;
+    char texto[512];        // Resumen del tick
+    size_t largo_texto;
+    uint8_t *datos;         // Cabecera fija y cuerpo del cuadro
+    size_t largo;
+} Cuadro;
+
+typedef struct Salida {
+    int tipo;               // SALIDA_*
+    int cada;               // Ticks entre cuadros
+    const char *ruta;       // NULL: stdout
+    FILE *archivo;
+    size_t cuerpo;          // Desplazamiento del cuerpo en "datos"
+    size_t *inicio_fila;    // ascii: inicio de las celdas de cada fila
+    Cuadro cuadros[2];
+    int actual;             // Cuadro que se llena ahora
+    bool error;
+} Salida;
+
+static const uint8_t COLOR[4][3] = {
+    {16, 16, 16},           // EMPTY
+    {40, 160, 40},          // PLANT
+    {230, 200, 40},         // HERBIVORE
+    {200, 40, 40},          // CARNIVORE
+};
+static const uint8_t GRIS[4] = {0, 96, 176, 255};
+static const char SIMBOLO[4] = {' ', 'P', 'H', 'C'};
+
+// Arma en "d" (o solo mide, si d es NULL) la parte fija del cuadro ascii:
+// encabezado, bordes, índices de fila y los espacios entre celdas
+static size_t plantilla_ascii(const Mundo *m, uint8_t *d, size_t *inicio_fila) {
+    char num[16];
+    size_t n = 0;
+#define PONER(s, len) do { if (d) memcpy(d + n, (s), (len)); n += (len); } while (0)
+    PONER("    ", 4);
+    for (int j = 0; j < m->ancho; j++) {
+        int len = snprintf(num, sizeof(num), "%2d ", j);
+        PONER(num, (size_t) len);
+    }
+    PONER("\n", 1);
+
+    for (int borde = 0; borde < 2; borde++) {
+        PONER("   +", 4);
+        if (d) memset(d + n, '-', 3 * (size_t) m->ancho);
+        n += 3 * (size_t) m->ancho;
+        PONER("+\n", 2);
+        if (borde == 1) break;
+
+        for (int i = 0; i < m->alto; i++) {
+            int len = snprintf(num, sizeof(num), "%2d |", i);
+            PONER(num, (size_t) len);
+            if (inicio_fila) inicio_fila[i] = n;
+            if (d) memset(d + n, ' ', 3 * (size_t) m->ancho);
+            n += 3 * (size_t) m->ancho;
+            PONER("|\n", 2);
+        }
+    }
+#undef PONER
+    return n;
+}
+
+static size_t bytes_fila_binario(const Mundo *m) {
+    return ((size_t) m->ancho + 3) / 4;
+}
+
+// Escribe la parte fija de un cuadro y devuelve su tamaño total
+static size_t preparar_plantilla(Salida *s, const Mundo *m, uint8_t *d) {
+    char cab[64];
+    int len;
+    switch (s->tipo) {
+        case SALIDA_ASCII:
+            s->cuerpo = 0;
+            return plantilla_ascii(m, d, s->inicio_fila);
+        case SALIDA_BINARIO: {
+            CabeceraCuadro c = {.ancho = (uint32_t) m->ancho, .alto = (uint32_t) m->alto,
+                                .bytes_fila = (uint32_t) bytes_fila_binario(m)};
+            memcpy(c.magico, CUADRO_MAGICO, sizeof(c.magico));
+            if (d) memcpy(d, &c, sizeof(c));
+            s->cuerpo = sizeof(c);
+            return s->cuerpo + bytes_fila_binario(m) * m->alto;
+        }
+        case SALIDA_PPM:
+        case SALIDA_PGM:
+            len = snprintf(cab, sizeof(cab), "%s\n%d %d\n255\n", s->tipo == SALIDA_PPM ? "P6" : "P5", m->ancho, m->alto);
+            if (d) memcpy(d, cab, (size_t) len);
+            s->cuerpo = (size_t) len;
+            return s->cuerpo + (s->tipo == SALIDA_PPM ? 3 : 1) * m->celdas;
+        default:
+            s->cuerpo = 0;
+            return 0;
+    }
+}
+
+int crear_salida(Salida *s, const Mundo *m) {
+    s->archivo = stdout;
+    s->inicio_fila = NULL;
+    s->actual = 0;
+    s->error = false;
+    for (int c = 0; c < 2; c++) s->cuadros[c] = (Cuadro) {.salida = s};
+    if (s->tipo == SALIDA_NINGUNA) return 0;
+
+    if (s->ruta == NULL) s->ruta = RUTAS_SALIDA[s->tipo];
+    if (s->ruta != NULL && strcmp(s->ruta, "-") != 0) {
+        s->archivo = fopen(s->ruta, "wb");
+        if (s->archivo == NULL) {
+            fprintf(stderr, "No se pudo abrir %s\n", s->ruta);
+            return -1;
+        }
+    }
+    if (s->tipo == SALIDA_ASCII && (s->inicio_fila = malloc((size_t) m->alto * sizeof(size_t))) == NULL)
+        return -1;
+
+    size_t largo = preparar_plantilla(s, m, NULL);
+    for (int c = 0; c < 2 && largo > 0; c++) {
+        Cuadro *q = &s->cuadros[c];
+        if ((q->datos = malloc(largo)) == NULL) return -1;
+        q->largo = largo;
+        preparar_plantilla(s, m, q->datos);
+    }
+    return 0;
+}
+
+void destruir_salida(Salida *s) {
+    for (int c = 0; c < 2; c++) free(s->cuadros[c].datos);
+    free(s->inicio_fila);
+    if (s->archivo != NULL && s->archivo != stdout) fclose(s->archivo);
+    else fflush(stdout);
+    s->archivo = NULL;
+}
+
+// Tarea del escritor: vuelca un cuadro
+static void escribir_cuadro(void *arg) {
+    Cuadro *c = arg;
+    Salida *s = c->salida;
+    int ok = fwrite(c->texto, 1, c->largo_texto, stdout) == c->largo_texto;
+    if (c->largo > 0) ok &= fwrite(c->datos, 1, c->largo, s->archivo) == c->largo;
+    if (!ok && !s->error) {
+        fprintf(stderr, "Error al escribir la salida\n");
+        s->error = true;
+    }
+}
+
+// Arma el cuadro del tick en curso y se lo pasa al escritor. Lo deben llamar
+// todos los hilos del equipo.
+void emitir_cuadro(Mundo *m, Salida *s, Escritor *escritor) {
+    if (s->tipo == SALIDA_NINGUNA) return;
+    // El escritor ya terminó con este buffer: se lo entregamos hace dos
+    // cuadros y el último encargar esperó a que acabara
+    Cuadro *c = &s->cuadros[s->actual];
 
-// Locks por celda para proteger escrituras concurrentes en "copia"
-omp_lock_t locks[N][N];
+    #pragma omp single nowait
+    {
+        size_t n = texto_resumen(c->texto, sizeof(c->texto), m->poblacion);
+        n += texto_trafico(c->texto + n, sizeof(c->texto) - n, m);
+        int len = snprintf(c->texto + n, sizeof(c->texto) - n, "Modo: %s\n", m->disperso ? "disperso" : "denso");
+        c->largo_texto = n + (len > 0 ? (size_t) len : 0);
+        if (s->tipo == SALIDA_BINARIO) memcpy(c->datos + offsetof(CabeceraCuadro, tick), &(int64_t) {m->tick}, sizeof(int64_t));
+    }
 
-int dx[] = {-1, 1, 0, 0};
-int dy[] = {0, 0, -1, 1};
+    const uint8_t *tipo = m->ecosistema.tipo;
+    uint8_t *cuerpo = c->datos + s->cuerpo;
+    size_t bytes_fila = bytes_fila_binario(m);
 
-static inline void lock_cell(int i, int j) {
-    omp_set_lock(&locks[i][j]);
-}
-static inline void unlock_cell(int i, int j) {
-    omp_unset_lock(&locks[i][j]);
+    #pragma omp for schedule(static)
+    for (int i = 0; i < m->alto; i++) {
+        const uint8_t *t = tipo + pos(m, i, 0);
+        switch (s->tipo) {
+            case SALIDA_ASCII: {
+                uint8_t *d = c->datos + s->inicio_fila[i] + 1;
+                for (int j = 0; j < m->ancho; j++) d[3 * j] = (uint8_t) SIMBOLO[t[j] & 3];
+                break;
+            }
+            case SALIDA_BINARIO: {
+                uint8_t *d = cuerpo + bytes_fila * i;
+                memset(d, 0, bytes_fila);
+                for (int j = 0; j < m->ancho; j++) d[j >> 2] |= (uint8_t) ((t[j] & 3) << 2 * (j & 3));
+                break;
+            }
+            case SALIDA_PPM: {
+                uint8_t *d = cuerpo + 3 * pos(m, i, 0);
+                for (int j = 0; j < m->ancho; j++) memcpy(d + 3 * j, COLOR[t[j] & 3], 3);
+                break;
+            }
+            case SALIDA_PGM: {
+                uint8_t *d = cuerpo + pos(m, i, 0);
+                for (int j = 0; j < m->ancho; j++) d[j] = GRIS[t[j] & 3];
+                break;
+            }
+        }
+    }
+
+    #pragma omp single
+    {
+        encargar(escritor, escribir_cuadro, c);
+        s->actual ^= 1;
+    }
 }
 
-// Bloquea dos celdas en orden consistente (para evitar deadlocks)
-static inline void lock_two(int a1, int b1, int a2, int b2) {
-    if (a1 < a2 || (a1 == a2 && b1 <= b2)) {
-        omp_set_lock(&locks[a1][b1]);
-        omp_set_lock(&locks[a2][b2]);
-    } else {
-        omp_set_lock(&locks[a2][b2]);
-        omp_set_lock(&locks[a1][b1]);
+// ---------------------------- ESTADÍSTICAS ----------------------------
+//
+// Serie temporal por tick de la población y de los eventos que la cambiaron,
+// en CSV o (si la ruta termina en ".json") en un arreglo JSON. Los números
+// salen de los contadores que las reglas llevan por hilo, sin recorrer la
+// rejilla.
+
+typedef struct {
+    FILE *archivo;
+    bool json;
+    long filas;
+} Estadisticas;
+
+// Columnas de muertes (solo las combinaciones que pueden ocurrir)
+static const struct {
+    int especie;
+    int causa;
+    const char *nombre;
+} COLUMNAS_MUERTE[] = {
+    {PLANT,     CAUSA_DEPREDACION, "muertes_plantas_depredacion"},
+    {PLANT,     CAUSA_SIN_ESPACIO, "muertes_plantas_sin_espacio"},
+    {HERBIVORE, CAUSA_HAMBRE,      "muertes_herbivoros_hambre"},
+    {HERBIVORE, CAUSA_VEJEZ,       "muertes_herbivoros_vejez"},
+    {HERBIVORE, CAUSA_DEPREDACION, "muertes_herbivoros_depredacion"},
+    {CARNIVORE, CAUSA_HAMBRE,      "muertes_carnivoros_hambre"},
+    {CARNIVORE, CAUSA_VEJEZ,       "muertes_carnivoros_vejez"},
+};
+#define NUM_COLUMNAS_MUERTE (sizeof(COLUMNAS_MUERTE) / sizeof(COLUMNAS_MUERTE[0]))
+
+static const char *const NOMBRES_POBLACION[4] = {NULL, "plantas", "herbivoros", "carnivoros"};
+
+int abrir_estadisticas(Estadisticas *est, const char *ruta) {
+    est->archivo = NULL;
+    est->filas = 0;
+    if (ruta == NULL) return 0;
+
+    size_t largo = strlen(ruta);
+    est->json = largo >= 5 && strcmp(ruta + largo - 5, ".json") == 0;
+    est->archivo = strcmp(ruta, "-") == 0 ? stdout : fopen(ruta, "w");
+    if (est->archivo == NULL) {
+        fprintf(stderr, "No se pudo abrir %s\n", ruta);
+        return -1;
     }
+
+    if (est->json) {
+        fputs("[", est->archivo);
+        return 0;
+    }
+    fputs("tick", est->archivo);
+    for (int e = PLANT; e <= CARNIVORE; e++) fprintf(est->archivo, ",%s", NOMBRES_POBLACION[e]);
+    for (int e = PLANT; e <= CARNIVORE; e++) fprintf(est->archivo, ",nacimientos_%s", NOMBRES_POBLACION[e]);
+    for (size_t c = 0; c < NUM_COLUMNAS_MUERTE; c++) fprintf(est->archivo, ",%s", COLUMNAS_MUERTE[c].nombre);
+    fputs("\n", est->archivo);
+    return 0;
 }
-static inline void unlock_two(int a1, int b1, int a2, int b2) {
-    // Desbloquea en orden inverso al que bloqueaste (no obligatorio, pero ordenado)
-    if (a1 < a2 || (a1 == a2 && b1 <= b2)) {
-        omp_unset_lock(&locks[a2][b2]);
-        omp_unset_lock(&locks[a1][b1]);
+
+// Agrega la fila del tick que terminó. La llama un solo hilo.
+void registrar_estadisticas(Estadisticas *est, const Mundo *m) {
+    FILE *f = est->archivo;
+    if (f == NULL) return;
+    const Contadores *ev = &m->eventos;
+
+    if (est->json) {
+        fprintf(f, "%s\n  {\"tick\": %ld", est->filas ? "," : "", m->tick);
+        for (int e = PLANT; e <= CARNIVORE; e++) fprintf(f, ", \"%s\": %ld", NOMBRES_POBLACION[e], m->poblacion[e]);
+        for (int e = PLANT; e <= CARNIVORE; e++)
+            fprintf(f, ", \"nacimientos_%s\": %ld", NOMBRES_POBLACION[e], ev->nacimientos[e]);
+        for (size_t c = 0; c < NUM_COLUMNAS_MUERTE; c++)
+            fprintf(f, ", \"%s\": %ld", COLUMNAS_MUERTE[c].nombre,
+                    ev->muertes[COLUMNAS_MUERTE[c].especie][COLUMNAS_MUERTE[c].causa]);
+        fputs("}", f);
     } else {
-        omp_unset_lock(&locks[a1][b1]);
-        omp_unset_lock(&locks[a2][b2]);
+        fprintf(f, "%ld", m->tick);
+        for (int e = PLANT; e <= CARNIVORE; e++) fprintf(f, ",%ld", m->poblacion[e]);
+        for (int e = PLANT; e <= CARNIVORE; e++) fprintf(f, ",%ld", ev->nacimientos[e]);
+        for (size_t c = 0; c < NUM_COLUMNAS_MUERTE; c++)
+            fprintf(f, ",%ld", ev->muertes[COLUMNAS_MUERTE[c].especie][COLUMNAS_MUERTE[c].causa]);
+        fputs("\n", f);
     }
+    est->filas++;
+}
+
+void cerrar_estadisticas(Estadisticas *est) {
+    if (est->archivo == NULL) return;
+    if (est->json) fputs("\n]\n", est->archivo);
+    if (est->archivo != stdout) fclose(est->archivo);
+    else fflush(stdout);
+    est->archivo = NULL;
+}
+
+// --------------------------- INSTRUMENTACIÓN ---------------------------
+//
+// Compilando con -DECO_INSTRUMENTAR cada hilo cuenta, por fase, las palabras
+// de 64 celdas que recorre, los agentes que procesa, las celdas que pide
+// como destino y cuántas pierde ante otro agente, y el tiempo que espera en
+// las barreras. No hay locks: los conflictos son los destinos que gana otro
+// animal (gana_destino) y las semillas que ya tomó otra planta o reclamó un
+// carnívoro. Con --traza F la línea de tiempo se escribe en el formato de
+// eventos de Chrome (chrome://tracing o ui.perfetto.dev), con un tramo por
+// fase y por barrera de cada hilo y los contadores de la fase como
+// argumentos, y al final se imprime el resumen por fase y por hilo.
+
+#ifdef ECO_INSTRUMENTAR
+static const char *const FASES_TRAZA[NUM_FASES] = {
+    "herbivoros", "plantas_carnivoros", "intercambio", "mascaras", "modo"
+};
+
+static void sumar_metricas(Metricas *a, const Metricas *b) {
+    a->palabras += b->palabras;
+    a->agentes += b->agentes;
+    a->reclamos += b->reclamos;
+    a->conflictos += b->conflictos;
+    a->espera += b->espera;
+}
+
+static void imprimir_cabecera(const char *titulo, const char *nombre) {
+    printf("%s\n  %-20s %14s %12s %12s %12s %10s\n", titulo, nombre,
+           "palabras", "agentes", "reclamos", "conflictos", "espera_s");
+}
+
+static void imprimir_metricas(const char *nombre, const Metricas *x) {
+    printf("  %-20s %14ld %12ld %12ld %12ld %10.6f\n",
+           nombre, x->palabras, x->agentes, x->reclamos, x->conflictos, x->espera);
 }
 
-int es_valida(int x, int y) {
-    return x >= 0 && x < N && y >= 0 && y < N;
+void imprimir_instrumentacion(const Mundo *m) {
+    imprimir_cabecera("Instrumentación por fase (suma de los hilos):", "fase");
+    for (int fase = 0; fase < NUM_FASES; fase++) {
+        Metricas x = {0};
+        for (int h = 0; h < m->num_contadores; h++) sumar_metricas(&x, &m->instrumento[h].total[fase]);
+        imprimir_metricas(FASES_TRAZA[fase], &x);
+    }
+    imprimir_cabecera("Instrumentación por hilo (todas las fases):", "hilo");
+    for (int h = 0; h < m->num_contadores; h++) {
+        Metricas x = {0};
+        for (int fase = 0; fase < NUM_FASES; fase++) sumar_metricas(&x, &m->instrumento[h].total[fase]);
+        char nombre[16];
+        snprintf(nombre, sizeof(nombre), "%d", h);
+        imprimir_metricas(nombre, &x);
+    }
 }
 
-// Función para inicializar la matriz (capping total a N*N)
-void inicializar_ecosistema(int num_plantas, int num_herviboros, int num_carnivoros) {
-    // Inicializar todo vacío
-    #pragma omp parallel for collapse(2)
-    for (int i = 0; i < N; i++) {
-        for (int j = 0; j < N; j++) {
-            ecosistema[i][j].tipo = EMPTY;
-            ecosistema[i][j].energia = 0;
-            ecosistema[i][j].ticks_sin_comer = 0;
-            ecosistema[i][j].edad = 0;
+// Escribe los tramos de todos los hilos como eventos "X" (con duración), en
+// microsegundos desde el primero
+int escribir_traza(const Mundo *m, const char *ruta) {
+    FILE *f = fopen(ruta, "w");
+    if (f == NULL) {
+        fprintf(stderr, "No se pudo abrir la traza %s\n", ruta);
+        return -1;
+    }
+    double origen = 0;
+    bool primero = true;
+    for (int h = 0; h < m->num_contadores; h++) {
+        const Instrumento *in = &m->instrumento[h];
+        if (in->num_tramos > 0 && (primero || in->tramos[0].inicio < origen)) origen = in->tramos[0].inicio;
+        primero &= in->num_tramos == 0;
+    }
+
+    fputs("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n", f);
+    fputs("{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, \"args\": {\"name\": \"ecosistema\"}}", f);
+    for (int h = 0; h < m->num_contadores; h++) {
+        const Instrumento *in = &m->instrumento[h];
+        fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, \"args\": {\"name\": \"hilo %d\"}}",
+                h, h);
+        for (size_t n = 0; n < in->num_tramos; n++) {
+            const Tramo *t = &in->tramos[n];
+            fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, "
+                       "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"tick\": %ld",
+                    t->fase < 0 ? "barrera" : FASES_TRAZA[t->fase], t->fase < 0 ? "barrera" : "fase", h,
+                    1e6 * (t->inicio - origen), 1e6 * (t->fin - t->inicio), t->tick);
+            if (t->fase >= 0)
+                fprintf(f, ", \"palabras\": %ld, \"agentes\": %ld, \"reclamos\": %ld, \"conflictos\": %ld, \"espera_us\": %.3f",
+                        t->metricas.palabras, t->metricas.agentes, t->metricas.reclamos,
+                        t->metricas.conflictos, 1e6 * t->metricas.espera);
+            fputs("}}", f);
         }
     }
-    int total = num_plantas + num_herviboros + num_carnivoros;
-    if (total > N * N) total = N * N; // evitar bucle infinito
+    fputs("\n]}\n", f);
+
+    int error = ferror(f);
+    if (fclose(f) != 0 || error) {
+        fprintf(stderr, "Error al escribir la traza %s\n", ruta);
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+// ------------------------------ ENSAMBLE ------------------------------
+//
+// Muchos mundos chicos e independientes a la vez, uno por hilo. Cada
+// combinación de los valores dados (producto de las listas de reglas y
+// poblaciones) se simula con --replicas semillas, y el informe resume cada
+// combinación en una fila. Cada mundo corre en su propio equipo de un hilo,
+// al que se ligan los constructos huérfanos del tick: no hay barreras entre
+// mundos y el reparto dinámico compensa los que se extinguen antes. La
+// réplica r usa semilla + r en todas las combinaciones, así las diferencias
+// entre combinaciones no son ruido de la semilla.
+
+#define MAX_MUNDOS_ENSAMBLE (1L << 24)
+
+// Combinaciones del barrido
+static long num_variantes(const Config *cfg) {
+    long n = 1;
+    for (int p = 0; p < NUM_PARAMETROS; p++) n *= cfg->num_valores[p];
+    return n;
+}
+
+// Valores de la combinación v (el último parámetro es el que cambia más rápido)
+static void valores_variante(const Config *cfg, long v, long valores[NUM_PARAMETROS]) {
+    for (int p = NUM_PARAMETROS - 1; p >= 0; p--) {
+        valores[p] = cfg->valores[p][v % cfg->num_valores[p]];
+        v /= cfg->num_valores[p];
+    }
+}
+
+// Cómo terminó un mundo del ensamble
+typedef struct {
+    long poblacion[4];
+    long nacimientos[4];
+    long muertes[4];        // Todas las causas
+    long extincion[4];      // Tick en que la especie llegó a cero (-1: sobrevivió)
+    uint64_t firma;
+} Desenlace;
 
-    int colocados = 0;
-    while (colocados < total) {
-        int i = rand() % N;
-        int j = rand() % N;
+static int simular_mundo(const Config *cfg, const long valores[NUM_PARAMETROS], int replica, Desenlace *d) {
+    int r = 0;
+    *d = (Desenlace) {.extincion = {-1, -1, -1, -1}};
 
-        if (ecosistema[i][j].tipo == EMPTY) {
-            if (colocados < num_plantas) {
-                ecosistema[i][j].tipo = PLANT;
-                // demás campos no necesarios para planta
-            } else if (colocados < num_plantas + num_herviboros) {
-                ecosistema[i][j].tipo = HERBIVORE;
-                ecosistema[i][j].energia = ENERGIA_NUEVO;
-                ecosistema[i][j].edad = 0;
-                ecosistema[i][j].ticks_sin_comer = 0;
+    #pragma omp parallel num_threads(1)
+    {
+        Mundo m;
+        if (crear_mundo(&m, cfg->ancho, cfg->alto, NULL, 0) != 0) {
+            r = -1;
+        } else {
+            fijar_topologia(&m, cfg->toroide, cfg->toroide, cfg->vecinos);
+            m.reglas = reglas_de(valores);
+            m.semilla = cfg->semilla + (uint64_t) replica;
+            m.tick = 0;
+            if (inicializar_ecosistema(&m, &cfg->distribucion,
+                                       valores[PARAM_PLANTAS], valores[PARAM_HERBIVOROS], valores[PARAM_CARNIVOROS]) != 0) {
+                r = -1;
             } else {
-                ecosistema[i][j].tipo = CARNIVORE;
-                ecosistema[i][j].energia = ENERGIA_NUEVO;
-                ecosistema[i][j].edad = 0;
-                ecosistema[i][j].ticks_sin_comer = 0;
+                m.modo = cfg->modo;
+                recontar_poblacion(&m);
+                for (int e = PLANT; e <= CARNIVORE; e++)
+                    if (m.poblacion[e] == 0) d->extincion[e] = 0;
+
+                construir_mascaras(&m);
+                ajustar_modo(&m);
+                for (long t = 0; t < cfg->ticks; t++) {
+                    avanzar_tick(&m);
+                    m.tick++;
+                    for (int e = PLANT; e <= CARNIVORE; e++) {
+                        d->nacimientos[e] += m.eventos.nacimientos[e];
+                        for (int causa = 0; causa < NUM_CAUSAS; causa++) d->muertes[e] += m.eventos.muertes[e][causa];
+                        if (m.poblacion[e] == 0 && d->extincion[e] < 0) d->extincion[e] = m.tick;
+                    }
+                    m.bytes_tick = 0;
+                    m.eventos = (Contadores) {0};
+                }
+
+                memcpy(d->poblacion, m.poblacion, sizeof(d->poblacion));
+                d->firma = firma_ecosistema(&m);
             }
-            colocados++;
+            destruir_mundo(&m);
+        }
+    }
+    return r;
+}
+
+// Fila del informe: la combinación v resumida sobre sus réplicas
+static void escribir_variante(FILE *f, bool json, const Config *cfg, long v, const Desenlace *d) {
+    long valores[NUM_PARAMETROS];
+    valores_variante(cfg, v, valores);
+
+    double media_pob[4] = {0}, media_nac[4] = {0}, media_muertes[4] = {0};
+    long extinciones[4] = {0};
+    uint64_t firma = 0;
+    for (int r = 0; r < cfg->replicas; r++) {
+        for (int e = PLANT; e <= CARNIVORE; e++) {
+            media_pob[e] += (double) d[r].poblacion[e] / cfg->replicas;
+            media_nac[e] += (double) d[r].nacimientos[e] / cfg->replicas;
+            media_muertes[e] += (double) d[r].muertes[e] / cfg->replicas;
+            extinciones[e] += d[r].extincion[e] >= 0;
         }
+        firma += d[r].firma;
+    }
+
+    if (json) {
+        fprintf(f, "%s\n  {\"variante\": %ld", v ? "," : "", v);
+        for (int p = 0; p < NUM_PARAMETROS; p++) fprintf(f, ", \"%s\": %ld", PARAMETROS[p].columna, valores[p]);
+        fprintf(f, ", \"replicas\": %d", cfg->replicas);
+        for (int e = PLANT; e <= CARNIVORE; e++) fprintf(f, ", \"media_%s\": %.2f", NOMBRES_POBLACION[e], media_pob[e]);
+        for (int e = PLANT; e <= CARNIVORE; e++) fprintf(f, ", \"extinciones_%s\": %ld", NOMBRES_POBLACION[e], extinciones[e]);
+        for (int e = PLANT; e <= CARNIVORE; e++) fprintf(f, ", \"media_nacimientos_%s\": %.2f", NOMBRES_POBLACION[e], media_nac[e]);
+        for (int e = PLANT; e <= CARNIVORE; e++) fprintf(f, ", \"media_muertes_%s\": %.2f", NOMBRES_POBLACION[e], media_muertes[e]);
+        fprintf(f, ", \"firma\": \"%016llx\"}", (unsigned long long) firma);
+    } else {
+        fprintf(f, "%ld", v);
+        for (int p = 0; p < NUM_PARAMETROS; p++) fprintf(f, ",%ld", valores[p]);
+        fprintf(f, ",%d", cfg->replicas);
+        for (int e = PLANT; e <= CARNIVORE; e++) fprintf(f, ",%.2f", media_pob[e]);
+        for (int e = PLANT; e <= CARNIVORE; e++) fprintf(f, ",%ld", extinciones[e]);
+        for (int e = PLANT; e <= CARNIVORE; e++) fprintf(f, ",%.2f", media_nac[e]);
+        for (int e = PLANT; e <= CARNIVORE; e++) fprintf(f, ",%.2f", media_muertes[e]);
+        fprintf(f, ",%016llx\n", (unsigned long long) firma);
+    }
+}
+
+int correr_ensamble(const Config *cfg) {
+    long variantes = num_variantes(cfg);
+    if (variantes > MAX_MUNDOS_ENSAMBLE / cfg->replicas) {
+        fprintf(stderr, "Demasiados mundos en el ensamble (máximo %ld)\n", MAX_MUNDOS_ENSAMBLE);
+        return -1;
+    }
+    long mundos = variantes * cfg->replicas;
+    Desenlace *d = malloc((size_t) mundos * sizeof(Desenlace));
+    if (d == NULL) {
+        fprintf(stderr, "Sin memoria para %ld mundos\n", mundos);
+        return -1;
+    }
+
+    int errores = 0;
+    double inicio = omp_get_wtime();
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:errores)
+    for (long w = 0; w < mundos; w++) {
+        long valores[NUM_PARAMETROS];
+        valores_variante(cfg, w / cfg->replicas, valores);
+        errores += simular_mundo(cfg, valores, (int) (w % cfg->replicas), &d[w]) != 0;
     }
+    double segundos = omp_get_wtime() - inicio;
+    if (errores) {
+        fprintf(stderr, "Sin memoria para un ecosistema de %dx%d o su población inicial\n", cfg->ancho, cfg->alto);
+        free(d);
+        return -1;
+    }
+
+    const char *ruta = cfg->ensamble_ruta;
+    FILE *f = ruta == NULL || strcmp(ruta, "-") == 0 ? stdout : fopen(ruta, "w");
+    if (f == NULL) {
+        fprintf(stderr, "No se pudo abrir %s\n", ruta);
+        free(d);
+        return -1;
+    }
+    size_t largo = ruta != NULL ? strlen(ruta) : 0;
+    bool json = largo >= 5 && strcmp(ruta + largo - 5, ".json") == 0;
+    if (json) {
+        fputs("[", f);
+    } else {
+        fputs("variante", f);
+        for (int p = 0; p < NUM_PARAMETROS; p++) fprintf(f, ",%s", PARAMETROS[p].columna);
+        fputs(",replicas", f);
+        for (int e = PLANT; e <= CARNIVORE; e++) fprintf(f, ",media_%s", NOMBRES_POBLACION[e]);
+        for (int e = PLANT; e <= CARNIVORE; e++) fprintf(f, ",extinciones_%s", NOMBRES_POBLACION[e]);
+        for (int e = PLANT; e <= CARNIVORE; e++) fprintf(f, ",media_nacimientos_%s", NOMBRES_POBLACION[e]);
+        for (int e = PLANT; e <= CARNIVORE; e++) fprintf(f, ",media_muertes_%s", NOMBRES_POBLACION[e]);
+        fputs(",firma\n", f);
+    }
+    for (long v = 0; v < variantes; v++) escribir_variante(f, json, cfg, v, &d[v * cfg->replicas]);
+    if (json) fputs("\n]\n", f);
+    if (f != stdout) fclose(f);
+
+    fprintf(stderr, "Ensamble: %ld mundos de %dx%d, %d ticks, en %.3f s (%.0f celdas por segundo)\n",
+            mundos, cfg->ancho, cfg->alto, cfg->ticks, segundos,
+            segundos > 0 ? (double) mundos * cfg->ancho * cfg->alto * cfg->ticks / segundos : 0);
+    free(d);
+    return 0;
 }
 
-// Imprimir el estado del ecosistema (como lo tenías)
-void imprimir_ecosistema() {
-    // Imprimir encabezado de columnas
-    printf("    ");
-    for (int j = 0; j < N; j++)
-        printf("%2d ", j);
-    printf("\n");
+// ------------------------------ BENCHMARK ------------------------------
+//
+// Barrido de tamaños, densidades e hilos con semilla fija, para comparar
+// commits. Cada corrida mide solo los ticks (sin salida ni checkpoints),
+// con el reloj de cada fase y la espera en barreras (ver barrera y
+// cronometrar). La eficiencia es la aceleración respecto de la corrida con
+// menos hilos de la misma configuración, dividida por el cociente de hilos.
+
+#define SEMILLA_BENCHMARK 42
 
-    // Línea superior
-    printf("   +");
-    for (int j = 0; j < N; j++)
-        printf("---");
-    printf("+\n");
+// Reparto de la ocupación entre especies (%)
+#define BENCH_PLANTAS     50
+#define BENCH_HERBIVOROS  35
 
-    for (int i = 0; i < N; i++) {
-        printf("%2d |", i); // Índice de fila
+typedef struct {
+    int tamano;
+    int densidad;
+    int hilos;
+    bool disco;             // Rejilla fuera de memoria (--disco)
+    const char *nucleos;    // Versión de los núcleos que se usó
+    double segundos;
+    double tiempo_fase[NUM_FASES];
+    double espera;          // Promedio por hilo
+    size_t residente;       // Memoria residente máxima medida (bytes)
+    uint64_t firma;
+} Medicion;
+
+static const char *const NOMBRES_FASE[NUM_FASES] = {
+    "herbivoros_s", "plantas_carnivoros_s", "intercambio_s", "mascaras_s", "modo_s"
+};
+static const char *const NOMBRES_MODO[] = {"auto", "denso", "disperso"};
+
+static int medir_corrida(const Config *cfg, Medicion *r) {
+    // El número de hilos se fija antes de crear el mundo: dimensiona los contadores
+    omp_set_num_threads(r->hilos);
+    Mundo m;
+    if (crear_mundo(&m, r->tamano, r->tamano, r->disco ? cfg->disco : NULL, cfg->presupuesto) != 0) {
+        fprintf(stderr, "Sin memoria para un ecosistema de %dx%d\n", r->tamano, r->tamano);
+        return -1;
+    }
+    long ocupadas = (long) (m.celdas * (size_t) r->densidad / 100);
+    long plantas = ocupadas * BENCH_PLANTAS / 100;
+    long herbivoros = ocupadas * BENCH_HERBIVOROS / 100;
+    long valores[NUM_PARAMETROS];
+    valores_variante(cfg, 0, valores);
+    fijar_topologia(&m, cfg->toroide, cfg->toroide, cfg->vecinos);
+    m.reglas = reglas_de(valores);
+    r->nucleos = elegir_nucleos(&m.reglas, m.topologia.vecinos)->nombre;
+    m.semilla = cfg->semilla_dada ? cfg->semilla : SEMILLA_BENCHMARK;
+    m.tick = 0;
+    if (inicializar_ecosistema(&m, &cfg->distribucion, plantas, herbivoros, ocupadas - plantas - herbivoros) != 0) {
+        fprintf(stderr, "Sin memoria para colocar la población inicial\n");
+        destruir_mundo(&m);
+        return -1;
+    }
+    m.modo = cfg->modo;
+    recontar_poblacion(&m);
+    if (r->disco) soltar_disco(&m);
+
+    double inicio = 0;
+    #pragma omp parallel
+    {
+        construir_mascaras(&m);
+        ajustar_modo(&m);
 
-        for (int j = 0; j < N; j++) {
-            char simbolo;
-            switch (ecosistema[i][j].tipo) {
-                case PLANT:     simbolo = 'P'; break;
-                case HERBIVORE: simbolo = 'H'; break;
-                case CARNIVORE: simbolo = 'C'; break;
-                default:        simbolo = ' '; break;
+        #pragma omp single
+        {
+            m.medir = true;
+            inicio = omp_get_wtime();
+        }
+
+        for (long t = 0; t < cfg->ticks; t++) {
+            avanzar_tick(&m);
+            #pragma omp single
+            {
+                m.tick++;
+                m.bytes_tick = 0;
+                m.eventos = (Contadores) {0};
             }
-            printf(" %c ", simbolo);
         }
 
-        printf("|\n");
+        #pragma omp master
+        r->segundos = omp_get_wtime() - inicio;
     }
 
-    // Línea inferior
-    printf("   +");
-    for (int j = 0; j < N; j++)
-        printf("---");
-    printf("+\n");
+    memcpy(r->tiempo_fase, m.tiempo_fase, sizeof(r->tiempo_fase));
+    r->espera = 0;
+    for (int h = 0; h < m.num_contadores; h++) r->espera += m.espera[h].segundos;
+    r->espera /= m.num_contadores;
+    r->residente = memoria_residente();
+    if (m.disco.residente_max > r->residente) r->residente = m.disco.residente_max;
+    r->firma = firma_ecosistema(&m);
+    destruir_mundo(&m);
+    return 0;
 }
 
-// Imprimir tamaño de cada población
-void imprimir_resumen() {
-    int count_plant = 0;
-    int count_herbivore = 0;
-    int count_carnivore = 0;
-    int count_empty = 0;
-
-    for (int i = 0; i < N; i++) {
-        for (int j = 0; j < N; j++) {
-            switch (ecosistema[i][j].tipo) {
-                case PLANT: count_plant++; break;
-                case HERBIVORE: count_herbivore++; break;
-                case CARNIVORE: count_carnivore++; break;
-                default: count_empty++;
+static void escribir_medicion(FILE *f, bool json, bool primera, const Config *cfg, const Medicion *r, double eficiencia) {
+    double celdas_s = r->segundos > 0 ? (double) r->tamano * r->tamano * cfg->ticks / r->segundos : 0;
+    const char *almacen = r->disco ? "disco" : "memoria";
+    double residente_mb = (double) r->residente / (1 << 20);
+    if (json) {
+        fprintf(f, "%s\n  {\"tamano\": %d, \"densidad\": %d, \"hilos\": %d, \"ticks\": %d, \"modo\": \"%s\", "
+                "\"almacen\": \"%s\", \"nucleos\": \"%s\", \"segundos\": %.6f, \"celdas_por_segundo\": %.0f, \"eficiencia\": %.4f",
+                primera ? "" : ",", r->tamano, r->densidad, r->hilos, cfg->ticks, NOMBRES_MODO[cfg->modo],
+                almacen, r->nucleos, r->segundos, celdas_s, eficiencia);
+        for (int fase = 0; fase < NUM_FASES; fase++) fprintf(f, ", \"%s\": %.6f", NOMBRES_FASE[fase], r->tiempo_fase[fase]);
+        fprintf(f, ", \"espera_barreras_s\": %.6f, \"residente_mb\": %.1f, \"firma\": \"%016llx\"}",
+                r->espera, residente_mb, (unsigned long long) r->firma);
+    } else {
+        fprintf(f, "%d,%d,%d,%d,%s,%s,%s,%.6f,%.0f,%.4f", r->tamano, r->densidad, r->hilos, cfg->ticks,
+                NOMBRES_MODO[cfg->modo], almacen, r->nucleos, r->segundos, celdas_s, eficiencia);
+        for (int fase = 0; fase < NUM_FASES; fase++) fprintf(f, ",%.6f", r->tiempo_fase[fase]);
+        fprintf(f, ",%.6f,%.1f,%016llx\n", r->espera, residente_mb, (unsigned long long) r->firma);
+    }
+    fflush(f);
+}
+
+int correr_benchmark(Config *cfg) {
+    // Por defecto, potencias de 2 hasta el máximo de hilos (y el máximo mismo)
+    if (cfg->num_hilos == 0) {
+        int maximo = omp_get_max_threads();
+        for (int h = 1; h < maximo && cfg->num_hilos < MAX_BARRIDO - 1; h *= 2)
+            cfg->hilos[cfg->num_hilos++] = h;
+        cfg->hilos[cfg->num_hilos++] = maximo;
+    }
+
+    const char *ruta = cfg->benchmark_ruta;
+    FILE *f = ruta == NULL || strcmp(ruta, "-") == 0 ? stdout : fopen(ruta, "w");
+    if (f == NULL) {
+        fprintf(stderr, "No se pudo abrir %s\n", ruta);
+        return -1;
+    }
+    size_t largo = ruta != NULL ? strlen(ruta) : 0;
+    bool json = largo >= 5 && strcmp(ruta + largo - 5, ".json") == 0;
+    if (json) {
+        fputs("[", f);
+    } else {
+        fputs("tamano,densidad,hilos,ticks,modo,almacen,nucleos,segundos,celdas_por_segundo,eficiencia", f);
+        for (int fase = 0; fase < NUM_FASES; fase++) fprintf(f, ",%s", NOMBRES_FASE[fase]);
+        fputs(",espera_barreras_s,residente_mb,firma\n", f);
+    }
+
+    int r = 0;
+    bool primera = true;
+    // Con --disco, cada combinación corre en memoria y fuera de memoria; la
+    // eficiencia se mide dentro de cada una
+    int almacenes = cfg->disco != NULL ? 2 : 1;
+    for (int a = 0; a < cfg->num_tamanos && r == 0; a++) {
+        for (int d = 0; d < cfg->num_densidades && r == 0; d++) {
+            for (int al = 0; al < almacenes && r == 0; al++) {
+                Medicion base = {0};
+                for (int h = 0; h < cfg->num_hilos; h++) {
+                    Medicion med = {
+                        .tamano = (int) cfg->tamanos[a],
+                        .densidad = (int) cfg->densidades[d],
+                        .hilos = (int) cfg->hilos[h],
+                        .disco = al == 1,
+                    };
+                    if ((r = medir_corrida(cfg, &med)) != 0) break;
+                    if (base.hilos == 0 || med.hilos < base.hilos) base = med;
+                    double eficiencia = med.segundos > 0 ? base.segundos / med.segundos * base.hilos / med.hilos : 0;
+                    escribir_medicion(f, json, primera, cfg, &med, eficiencia);
+                    primera = false;
+                }
             }
         }
     }
 
-    // Mostrar resumen
-    printf("\nResumen:\n");
-    printf("Plantas:     %d\n", count_plant);
-    printf("Herbívoros:  %d\n", count_herbivore);
-    printf("Carnívoros:  %d\n", count_carnivore);
-    printf("Vacíos:      %d\n", count_empty);
+    if (json) fputs("\n]\n", f);
+    if (f != stdout) fclose(f);
+    return r;
 }
 
-void plant_update() {
-    Celda copia[N][N];
+// ----------------------------- DISTRIBUIDO -----------------------------
+//
+// Compilado con -DUSE_MPI y lanzado con varios procesos (mpirun -np N), el
+// mundo se reparte por bloques de filas, uno por proceso, y cada uno guarda
+// además HALO filas fantasma de los vecinos de arriba y de abajo. Una fase
+// cambia una celda según el estado a distancia 4 como mucho (un herbívoro
+// decide mirando a distancia 2 y compite por su destino con otros que miran a
+// distancia 2 de ellos), así que con las fantasmas al día cada proceso calcula
+// sus filas propias igual que el mundo entero; lo que calcula en las fantasmas
+// se descarta. Un movimiento que cruza el borde se resuelve igual en los dos
+// procesos: ambos aplican la misma regla (gana el índice menor) a los mismos
+// datos. Cada fase corre en dos tandas de teselas: primero las filas de
+// teselas cercanas a los bordes, que dejan listas las filas propias que
+// esperan los vecinos; esas se envían y, mientras viajan, el equipo calcula
+// el interior y reconcilia los buffers. Después se copian las que llegaron a
+// las fantasmas.
+//
+// El generador y la firma usan el índice global de la celda (pos_global), así
+// el resultado es el mismo que con un solo proceso. En un toroide los procesos
+// forman un anillo: el primero recibe sus fantasmas de arriba del último y
+// viceversa, y las columnas dan la vuelta dentro de cada proceso. Solo hay
+// modo denso, y la salida es el resumen de poblaciones sumado entre procesos.
+//
+// El campo de percepción (ver CAMPO) mira más lejos que las fantasmas: cada
+// proceso tiene el del mundo completo, cuenta en él solo sus filas propias y
+// antes de la fase de herbívoros los conteos se suman entre todos
+// (MPI_Allreduce de un entero por bloque y especie, 1/32 de byte por celda).
 
-    // Copiar estado actual a copia (single-thread)
-    for (int i = 0; i < N; i++)
-        for (int j = 0; j < N; j++)
-            copia[i][j] = ecosistema[i][j];
+#ifdef USE_MPI
 
-    #pragma omp parallel for schedule(static)
-    for (int i = 0; i < N; i++) {
-        // semilla por fila/hilo
-        unsigned int seed = (unsigned int) time(NULL) ^ (unsigned) omp_get_thread_num() ^ (i * 73856093u);
+#define HALO 4
 
-        for (int j = 0; j < N; j++) {
-            if (ecosistema[i][j].tipo != PLANT) continue;
+typedef struct {
+    int rango, rangos;
+    int arriba, abajo;      // Filas fantasma de cada lado (0 en el borde de un mundo acotado)
+    int proceso_arriba, proceso_abajo;
+    int propias;            // Filas propias, justo después de las fantasma de arriba
+    MPI_Datatype bloque;    // HALO filas de los cuatro planos de un Planos
+    uint8_t *recibido[2];   // Fantasmas que llegan de arriba y de abajo, plano tras plano
+    unsigned char *borde[2];    // Filas de teselas de la primera tanda, al proponer y al aplicar
+    unsigned char *interior[2]; // Las de la segunda (ver fase_distribuida)
+    MPI_Request pedidos[4];
+    int num_pedidos;
+    long cuenta[4];         // Población de las filas propias (ver resumen_global)
+    uint32_t *campo[4];     // Prefijos del campo sumados entre procesos (solo con radio de percepción)
+} Dominio;
 
-            // Buscar vecinos vacíos leyendo SIEMPRE del estado viejo
-            int vecinos_V[4][2];
-            int count_V = 0;
+static int procesos_mpi(void) {
+    int n;
+    MPI_Comm_size(MPI_COMM_WORLD, &n);
+    return n;
+}
 
-            for (int d = 0; d < 4; d++) {
-                int ni = i + dx[d];
-                int nj = j + dy[d];
-                if (ni >= 0 && ni < N && nj >= 0 && nj < N) {
-                    if (ecosistema[ni][nj].tipo == EMPTY) {
-                        vecinos_V[count_V][0] = ni;
-                        vecinos_V[count_V][1] = nj;
-                        count_V++;
-                    }
-                }
-            }
+static void terminar_mpi(void) {
+    int terminado;
+    MPI_Finalized(&terminado);
+    if (!terminado) MPI_Finalize();
+}
 
-            // Muerte si no hay espacio
-            if (count_V == 0) {
-                // bloquear la celda (escritura en copia)
-                lock_cell(i, j);
-                copia[i][j].tipo = EMPTY;
-                unlock_cell(i, j);
-                continue;
-            }
+// Marca las tandas de cada fase. Al aplicar, la primera toma las filas de
+// teselas a HALO filas o menos de las filas que se envían (las fantasmas
+// incluidas): un agente escribe a lo sumo en su vecino, así el interior nunca
+// toca lo que se envía ni las fantasmas. Al proponer, la primera toma además
+// las filas de teselas vecinas, cuyas propuestas compiten con las del borde.
+static int elegir_tandas(const Mundo *m, Dominio *d) {
+    int filas = m->teselas.filas;
+    unsigned char *marcas = calloc(4 * (size_t) filas, 1);
+    if (marcas == NULL) return -1;
+    d->borde[0] = marcas;
+    d->borde[1] = marcas + filas;
+    d->interior[0] = marcas + 2 * filas;
+    d->interior[1] = marcas + 3 * filas;
 
-            // Reproducción/expansión: escribir en copia (cada destino protegido)
-            for (int d = 0; d < count_V; d++) {
-                if (rand() % 100 < 30) { // 30%
-                    int ni = vecinos_V[d][0];
-                    int nj = vecinos_V[d][1];
-                    // bloquear destino y origen para escribir consistentemente
-                    lock_two(ni, nj, i, j);
-                    // Escribir en destino (puede ser sobrescrito por otro hilo, lock lo serializa)
-                    copia[ni][nj].tipo = PLANT;
-                    // Nota: no toco energia/ticks/edad para plantas
-                    unlock_two(ni, nj, i, j);
-                }
+    int tramos[2][2] = {
+        {0, d->arriba > 0 ? d->arriba + 2 * HALO : 0},
+        {d->abajo > 0 ? d->arriba + d->propias - 2 * HALO : m->alto, m->alto},
+    };
+    for (int q = 0; q < 2; q++) {
+        int i0 = tramos[q][0] > 0 ? tramos[q][0] : 0;
+        int i1 = tramos[q][1] < m->alto ? tramos[q][1] : m->alto;
+        for (int f = i0 / TESELA_FILAS; f * TESELA_FILAS < i1; f++) d->borde[1][f] = 1;
+    }
+    for (int f = 0; f < filas; f++) {
+        d->borde[0][f] = d->borde[1][f] || (f > 0 && d->borde[1][f - 1]) || (f + 1 < filas && d->borde[1][f + 1]);
+        d->interior[0][f] = !d->borde[0][f];
+        d->interior[1][f] = !d->borde[1][f];
+    }
+    return 0;
+}
+
+// Envía las filas propias de los bordes del estado que dejó la primera tanda
+// de la fase (en "siguiente") y deja pedidas las fantasmas. Lo deben llamar
+// todos los hilos del equipo, antes de la segunda tanda.
+static void enviar_halos(Mundo *m, Dominio *d) {
+    #pragma omp single
+    {
+        const uint8_t *nuevo = m->siguiente.tipo;
+        int bytes = BYTES_CELDA * HALO * m->ancho;
+        d->num_pedidos = 0;
+        if (d->arriba > 0) {
+            MPI_Irecv(d->recibido[0], bytes, MPI_BYTE, d->proceso_arriba, 0, MPI_COMM_WORLD, &d->pedidos[d->num_pedidos++]);
+            MPI_Isend(nuevo + pos(m, d->arriba, 0), 1, d->bloque, d->proceso_arriba, 1,
+                      MPI_COMM_WORLD, &d->pedidos[d->num_pedidos++]);
+        }
+        if (d->abajo > 0) {
+            MPI_Irecv(d->recibido[1], bytes, MPI_BYTE, d->proceso_abajo, 1, MPI_COMM_WORLD, &d->pedidos[d->num_pedidos++]);
+            MPI_Isend(nuevo + pos(m, d->arriba + d->propias - HALO, 0), 1, d->bloque, d->proceso_abajo, 0,
+                      MPI_COMM_WORLD, &d->pedidos[d->num_pedidos++]);
+        }
+    }
+}
+
+// Anota como cambiadas todas las teselas que tocan las filas [i0, i1)
+static void marcar_filas(Mundo *m, int i0, int i1) {
+    const Teselas *ts = &m->teselas;
+    for (int f = i0 / TESELA_FILAS; f * TESELA_FILAS < i1; f++)
+        memset(ts->sucia + (size_t) f * ts->columnas, 1, ts->columnas);
+}
+
+// Espera las fantasmas, las copia a los dos buffers y marca sus teselas para
+// actualizar_mascaras. Lo deben llamar todos los hilos del equipo, después de
+// intercambiar_buffers.
+static void recibir_halos(Mundo *m, Dominio *d) {
+    #pragma omp single
+    {
+        MPI_Waitall(d->num_pedidos, d->pedidos, MPI_STATUSES_IGNORE);
+        size_t bytes = (size_t) HALO * m->ancho;
+        for (int lado = 0; lado < 2; lado++) {
+            if ((lado == 0 ? d->arriba : d->abajo) == 0) continue;
+            size_t k = lado == 0 ? 0 : pos(m, d->arriba + d->propias, 0);
+            for (int p = 0; p < BYTES_CELDA; p++) {
+                memcpy(m->ecosistema.tipo + p * m->celdas + k, d->recibido[lado] + p * bytes, bytes);
+                memcpy(m->siguiente.tipo + p * m->celdas + k, d->recibido[lado] + p * bytes, bytes);
             }
+            int i0 = lado == 0 ? 0 : d->arriba + d->propias;
+            marcar_filas(m, i0, i0 + HALO);
         }
     }
+}
 
-    // Aplicar cambios (single-thread)
-    for (int i = 0; i < N; i++)
-        for (int j = 0; j < N; j++)
-            ecosistema[i][j] = copia[i][j];
+// Pone al día el campo con los conteos de todos los procesos: la tabla se
+// rehace entera, porque no se sabe qué filas cambiaron en los demás. Lo
+// deben llamar todos los hilos del equipo.
+static void actualizar_campo_distribuido(Mundo *m, Dominio *d) {
+    contar_campo(m);
+    #pragma omp single
+    {
+        Campo *ca = &m->campo;
+        MPI_Allreduce(ca->fila[PLANT], d->campo[PLANT], 2 * ca->filas * ca->columnas, MPI_UINT32_T, MPI_SUM,
+                      MPI_COMM_WORLD);
+        ca->primera = 0;
+    }
+    sumar_campo(m, d->campo);
 }
 
-void carnivore_update() {
-    Celda copia[N][N];
+// Elige las filas de teselas de las pasadas que siguen. Lo deben llamar todos
+// los hilos del equipo.
+static void elegir_seleccion(Mundo *m, unsigned char *const filas[2]) {
+    #pragma omp single
+    {
+        m->seleccion[0] = filas != NULL ? filas[0] : NULL;
+        m->seleccion[1] = filas != NULL ? filas[1] : NULL;
+    }
+}
 
-    // Copiar estado actual (single-thread)
-    for (int i = 0; i < N; i++)
-        for (int j = 0; j < N; j++)
-            copia[i][j] = ecosistema[i][j];
+// Una fase con el intercambio de fantasmas solapado con el interior: la
+// primera tanda deja listas las filas que se envían, y la segunda corre
+// mientras viajan
+static void fase_distribuida(Mundo *m, Dominio *d, void (*fase)(Mundo *m)) {
+    elegir_seleccion(m, d->borde);
+    fase(m);
+    enviar_halos(m, d);
+    elegir_seleccion(m, d->interior);
+    fase(m);
+    elegir_seleccion(m, NULL);
+    intercambiar_buffers(m);
+    recibir_halos(m, d);
+    actualizar_mascaras(m);
+}
 
-    #pragma omp parallel for schedule(static)
-    for (int i = 0; i < N; i++) {
-        for (int j = 0; j < N; j++) {
-            if (ecosistema[i][j].tipo != CARNIVORE) continue;
+// El tick denso de avanzar_tick, con el intercambio de fantasmas en cada fase
+static void avanzar_tick_distribuido(Mundo *m, Dominio *d) {
+    if (m->reglas.radio_percepcion > 0) actualizar_campo_distribuido(m, d);
+    fase_distribuida(m, d, herbivore_update);
+    fase_distribuida(m, d, plant_carnivore_update);
+}
 
-            // 1. Muerte al inicio (lee ecosistema)
-            if (ecosistema[i][j].energia <= 0 ||
-                ecosistema[i][j].ticks_sin_comer >= MAX_TICKS_SIN_COMER ||
-                ecosistema[i][j].edad >= EDAD_MAXIMA) {
-                lock_cell(i, j);
-                copia[i][j].tipo = EMPTY;
-                unlock_cell(i, j);
-                continue;
-            }
+// Cuenta la población de las filas propias, la suma en el proceso 0 y este la
+// imprime. Lo deben llamar todos los hilos del equipo.
+static void resumen_global(const Mundo *m, Dominio *d) {
+    #pragma omp single
+    memset(d->cuenta, 0, sizeof(d->cuenta));
 
-            int hizo_algo = 0;
-            int dest_i = i, dest_j = j;
-
-            // 2. Comer (prioridad)
-            for (int d = 0; d < 4 && !hizo_algo; d++) {
-                int ni = i + dx[d];
-                int nj = j + dy[d];
-                if (es_valida(ni, nj) && ecosistema[ni][nj].tipo == HERBIVORE) {
-                    // bloquear destino y origen
-                    lock_two(ni, nj, i, j);
-                    copia[ni][nj].tipo = CARNIVORE;
-                    copia[ni][nj].energia = ecosistema[i][j].energia + 2;
-                    copia[ni][nj].ticks_sin_comer = 0;
-                    copia[ni][nj].edad = ecosistema[i][j].edad + 1;
-                    copia[i][j].tipo = EMPTY;
-                    unlock_two(ni, nj, i, j);
-
-                    dest_i = ni; dest_j = nj;
-                    hizo_algo = 1;
-                    break;
-                }
-            }
+    long c[4] = {0};
+    #pragma omp for schedule(static) nowait
+    for (int i = d->arriba; i < d->arriba + d->propias; i++) {
+        const uint8_t *tipo = m->ecosistema.tipo + pos(m, i, 0);
+        for (int j = 0; j < m->ancho; j++) c[tipo[j] & 3]++;
+    }
+    for (int e = 0; e < 4; e++) {
+        #pragma omp atomic
+        d->cuenta[e] += c[e];
+    }
+    #pragma omp barrier
 
-            // 3. Reproducirse (si no comió)
-            if (!hizo_algo && ecosistema[i][j].energia >= ENERGIA_REPRODUCCION) {
-                for (int d = 0; d < 4 && !hizo_algo; d++) {
-                    int ni = i + dx[d];
-                    int nj = j + dy[d];
-                    if (es_valida(ni, nj) && ecosistema[ni][nj].tipo == EMPTY) {
-                        lock_two(ni, nj, i, j);
-                        copia[ni][nj].tipo = CARNIVORE;
-                        copia[ni][nj].energia = ENERGIA_NUEVO;
-                        copia[ni][nj].ticks_sin_comer = 0;
-                        copia[ni][nj].edad = 0;
-
-                        // reducir energía en la posición original (en copia)
-                        copia[i][j].energia -= 2;
-                        unlock_two(ni, nj, i, j);
-
-                        hizo_algo = 1;
-                        break;
-                    }
-                }
-            }
+    #pragma omp single
+    {
+        long total[4];
+        MPI_Reduce(d->cuenta, total, 4, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (d->rango == 0) {
+            char texto[256];
+            texto_resumen(texto, sizeof(texto), total);
+            fputs(texto, stdout);
+        }
+    }
+}
 
-            // 4. Moverse (si no comió ni se reprodujo)
-            if (!hizo_algo) {
-                for (int d = 0; d < 4 && !hizo_algo; d++) {
-                    int ni = i + dx[d];
-                    int nj = j + dy[d];
-                    if (es_valida(ni, nj) && ecosistema[ni][nj].tipo == EMPTY) {
-                        lock_two(ni, nj, i, j);
-                        copia[ni][nj].tipo = CARNIVORE;
-                        copia[ni][nj].energia = ecosistema[i][j].energia;
-                        copia[ni][nj].ticks_sin_comer = ecosistema[i][j].ticks_sin_comer + 1;
-                        copia[ni][nj].edad = ecosistema[i][j].edad + 1;
-                        copia[i][j].tipo = EMPTY;
-                        unlock_two(ni, nj, i, j);
-
-                        dest_i = ni; dest_j = nj;
-                        hizo_algo = 1;
-                        break;
-                    }
-                }
-            }
+// Corrida con el mundo repartido entre los procesos. Las comprobaciones dan
+// lo mismo en todos, así que ninguno se queda esperando a otro que salió.
+int correr_distribuido(Config *cfg) {
+    Dominio d = {0};
+    MPI_Comm_rank(MPI_COMM_WORLD, &d.rango);
+    MPI_Comm_size(MPI_COMM_WORLD, &d.rangos);
+    int nivel;
+    MPI_Query_thread(&nivel);
+
+    const char *error = NULL;
+    if (nivel < MPI_THREAD_SERIALIZED)
+        error = "La biblioteca MPI no admite llamadas desde varios hilos (MPI_THREAD_SERIALIZED)";
+    else if (cfg->alto / d.rangos < HALO)
+        error = "Con varios procesos MPI cada uno necesita al menos 4 filas";
+    else if (cfg->toroide && cfg->alto - (cfg->alto + d.rangos - 1) / d.rangos < 2 * HALO)
+        error = "En un toroide con varios procesos MPI los demás procesos deben sumar al menos 8 filas";
+    else if ((size_t) BYTES_CELDA * HALO * cfg->ancho > INT_MAX)
+        error = "Filas demasiado anchas para los mensajes MPI";
+    else if (cfg->benchmark || cfg->ensamble || cfg->restaurar != NULL || cfg->checkpoint_cada > 0 ||
+             cfg->estadisticas != NULL || cfg->traza != NULL || cfg->disco != NULL)
+        error = "Con varios procesos MPI no hay benchmark, ensamble, checkpoints, estadísticas, traza ni disco";
+    if (error != NULL) {
+        if (d.rango == 0) fprintf(stderr, "%s\n", error);
+        return -1;
+    }
+
+    // La semilla por defecto sale de la hora: vale la del proceso 0
+    MPI_Bcast(&cfg->semilla, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+
+    int fila0 = (int) ((long) d.rango * cfg->alto / d.rangos);
+    d.propias = (int) ((long) (d.rango + 1) * cfg->alto / d.rangos) - fila0;
+    d.arriba = cfg->toroide || d.rango > 0 ? HALO : 0;
+    d.abajo = cfg->toroide || d.rango < d.rangos - 1 ? HALO : 0;
+    d.proceso_arriba = (d.rango + d.rangos - 1) % d.rangos;
+    d.proceso_abajo = (d.rango + 1) % d.rangos;
+
+    Mundo m;
+    size_t bytes_halo = (size_t) BYTES_CELDA * HALO * cfg->ancho;
+    int ok = crear_mundo(&m, cfg->ancho, d.arriba + d.propias + d.abajo, NULL, 0) == 0;
+    if (ok) {
+        long valores[NUM_PARAMETROS];
+        valores_variante(cfg, 0, valores);
+        m.fila0 = (fila0 - d.arriba + cfg->alto) % cfg->alto;
+        m.alto_total = cfg->alto;
+        // Las filas dan la vuelta entre procesos (por las fantasmas), no dentro
+        fijar_topologia(&m, false, cfg->toroide, cfg->vecinos);
+        m.reglas = reglas_de(valores);
+        // El campo es del mundo completo, y cada proceso cuenta sus filas propias
+        liberar_campo(&m.campo);
+        ok = reservar_campo(&m.campo, cfg->ancho, cfg->alto) == 0;
+        m.campo.propia0 = d.arriba;
+        m.campo.propia1 = d.arriba + d.propias;
+        size_t bloques_campo = (size_t) m.campo.filas * m.campo.columnas;
+        if (ok && m.reglas.radio_percepcion > 0) {
+            d.campo[PLANT] = malloc(2 * bloques_campo * sizeof(uint32_t));
+            ok = d.campo[PLANT] != NULL;
+            if (ok) d.campo[CARNIVORE] = d.campo[PLANT] + bloques_campo;
+        }
+        m.semilla = cfg->semilla;
+        m.tick = 0;
+        m.modo = MODO_DENSO;
+        d.recibido[0] = malloc(2 * bytes_halo);
+        d.recibido[1] = d.recibido[0] + bytes_halo;
+        ok = ok && d.recibido[0] != NULL && elegir_tandas(&m, &d) == 0 &&
+             inicializar_ecosistema(&m, &cfg->distribucion,
+                                    valores[PARAM_PLANTAS], valores[PARAM_HERBIVOROS], valores[PARAM_CARNIVOROS]) == 0;
+        if (!ok) {
+            free(d.recibido[0]);
+            free(d.borde[0]);
+            free(d.campo[PLANT]);
+            destruir_mundo(&m);
+        }
+    }
+    int todos;
+    MPI_Allreduce(&ok, &todos, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (!todos) {
+        if (!ok) fprintf(stderr, "Proceso %d: sin memoria para sus %d filas de %d\n", d.rango, d.propias, cfg->ancho);
+        else {
+            free(d.recibido[0]);
+            free(d.borde[0]);
+            free(d.campo[PLANT]);
+            destruir_mundo(&m);
+        }
+        return -1;
+    }
+    MPI_Type_create_hvector(BYTES_CELDA, HALO * cfg->ancho, (MPI_Aint) m.celdas, MPI_BYTE, &d.bloque);
+    MPI_Type_commit(&d.bloque);
+
+    if (d.rango == 0) {
+        printf("Ecosistema Inicial:\n");
+        printf("Celdas disponibles: %zu\n", (size_t) cfg->alto * cfg->ancho);
+        printf("Semilla: %llu\n", (unsigned long long) m.semilla);
+        printf("Procesos MPI: %d\n", d.rangos);
+    }
+    bool resumen = cfg->salida != SALIDA_NINGUNA;
+
+    #pragma omp parallel
+    {
+        resumen_global(&m, &d);
+        construir_mascaras(&m);
+
+        for (long t = 0; t < cfg->ticks; t++) {
+            avanzar_tick_distribuido(&m, &d);
 
-            // 5. Si no hizo nada, permanece y envejece (modificar copia en celda i,j)
-            if (!hizo_algo) {
-                lock_cell(i, j);
-                copia[i][j].ticks_sin_comer++;
-                copia[i][j].edad++;
-                unlock_cell(i, j);
+            #pragma omp single
+            {
+                m.tick++;
+                m.bytes_tick = 0;
+                m.eventos = (Contadores) {0};
             }
 
-            // 6. Pierde energía: decrementar en la celda final si sigue siendo carnívoro
-            // (aseguramos hacerlo con lock)
-            lock_cell(dest_i, dest_j);
-            if (copia[dest_i][dest_j].tipo == CARNIVORE) copia[dest_i][dest_j].energia--;
-            unlock_cell(dest_i, dest_j);
+            if (resumen && m.tick % cfg->salida_cada == 0)
+                resumen_global(&m, &d);
         }
     }
 
-    // Aplicar cambios (single-thread)
-    for (int i = 0; i < N; i++)
-        for (int j = 0; j < N; j++)
-            ecosistema[i][j] = copia[i][j];
+    uint64_t firma = firma_filas(&m, d.arriba, d.arriba + d.propias), total;
+    MPI_Reduce(&firma, &total, 1, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (d.rango == 0) printf("Firma final: %016llx\n", (unsigned long long) total);
+
+    MPI_Type_free(&d.bloque);
+    free(d.recibido[0]);
+    free(d.borde[0]);
+    free(d.campo[PLANT]);
+    destruir_mundo(&m);
+    return 0;
 }
 
-void herbivore_update() {
-    Celda copia[N][N];
+#endif // USE_MPI
 
-    // Copiar estado actual
-    for (int i = 0; i < N; i++)
-        for (int j = 0; j < N; j++)
-            copia[i][j] = ecosistema[i][j];
+// ---------------------------------- MAIN ----------------------------------
 
-    #pragma omp parallel for schedule(static)
-    for (int i = 0; i < N; i++) {
-        for (int j = 0; j < N; j++) {
-            if (ecosistema[i][j].tipo != HERBIVORE) continue;
+static void imprimir_uso(const char *prog) {
+    printf("Uso: %s [opciones]\n", prog);
+    printf("  -W, --ancho N        Columnas del ecosistema (50)\n");
+    printf("  -H, --alto N         Filas del ecosistema (50)\n");
+    printf("  -n, --tamano N       Ecosistema cuadrado NxN\n");
+    printf("  -t, --ticks N        Ticks a simular; al restaurar, tick final (10)\n");
+    printf("  -p, --plantas N      Plantas iniciales (300)\n");
+    printf("  -e, --herbivoros N   Herbívoros iniciales (200)\n");
+    printf("  -c, --carnivoros N   Carnívoros iniciales (75)\n");
+    printf("  --max-hambre N       Ticks sin comer hasta morir de hambre (3)\n");
+    printf("  --energia-reproduccion N  Energía mínima para reproducirse (2)\n");
+    printf("  --energia-cria N     Energía de una cría (2)\n");
+    printf("  --edad-maxima N      Edad a la que se muere de vejez (10)\n");
+    printf("  --prob-siembra N     %% de sembrar cada vecino vacío por tick (30)\n");
+    printf("  --radio-percepcion N Celdas a las que un herbívoro ve plantas y\n");
+    printf("                       carnívoros (0: solo sus vecinos)\n");
+    printf("  -s, --semilla N      Semilla del generador (por defecto, la hora)\n");
+    printf("  -m, --modo M         Representación: auto, denso o disperso (auto)\n");
+    printf("  --distribucion D     Población inicial: uniforme, grumos o un PGM (uniforme)\n");
+    printf("  --topologia T        acotada o toroide (acotada)\n");
+    printf("  --vecindad N         4 (von Neumann) u 8 (Moore) (4)\n");
+    printf("  --checkpoint-cada K  Guarda un checkpoint cada K ticks (0: nunca)\n");
+    printf("  --checkpoint-ruta F  Archivo del checkpoint (ecosistema.chk)\n");
+    printf("  --comprimir          Comprime el checkpoint por teselas (RLE)\n");
+    printf("  --restaurar F        Continúa desde el checkpoint F\n");
+    printf("  -o, --salida S       ascii, binario, ppm, pgm, resumen o ninguna (ascii)\n");
+    printf("  --salida-cada N      Emite un cuadro cada N ticks (1)\n");
+    printf("  --salida-ruta F      Archivo de los cuadros (\"-\": stdout)\n");
+    printf("  --estadisticas F     Serie por tick en CSV (o JSON si F termina en .json)\n");
+    printf("  --benchmark          Mide el barrido de tamaños, densidades e hilos\n");
+    printf("  --tamanos L          Lados del barrido, separados por comas (256,1024,2048)\n");
+    printf("  --densidades L       %% de celdas ocupadas del barrido (5,20,50)\n");
+    printf("  --hilos L            Hilos del barrido (potencias de 2 hasta el máximo)\n");
+    printf("  --benchmark-ruta F   Resultados en CSV (o JSON si F termina en .json)\n");
+    printf("  --ensamble           Un mundo por combinación de valores (las opciones de\n");
+    printf("                       reglas y poblaciones aceptan listas: 2,3,4)\n");
+    printf("  --replicas N         Semillas por combinación del ensamble (1)\n");
+    printf("  --ensamble-ruta F    Informe en CSV (o JSON si F termina en .json)\n");
+    printf("  --traza F            Traza de eventos de Chrome y resumen por fase e hilo\n");
+    printf("                       (requiere compilar con -DECO_INSTRUMENTAR)\n");
+    printf("  --disco DIR          Rejilla en archivos de DIR, por franjas de filas\n");
+    printf("  --presupuesto-mb N   Memoria para la rejilla fuera de memoria (1024)\n");
+    printf("  -h, --ayuda          Muestra esta ayuda\n");
+}
 
-            // 1. Muerte al inicio
-            if (ecosistema[i][j].energia <= 0 ||
-                ecosistema[i][j].ticks_sin_comer >= MAX_TICKS_SIN_COMER ||
-                ecosistema[i][j].edad >= EDAD_MAXIMA) {
-                lock_cell(i, j);
-                copia[i][j].tipo = EMPTY;
-                unlock_cell(i, j);
-                continue;
-            }
+// Opciones sin letra
+enum {
+    OPCION_CHECKPOINT_CADA = 256,
+    OPCION_CHECKPOINT_RUTA,
+    OPCION_COMPRIMIR,
+    OPCION_RESTAURAR,
+    OPCION_SALIDA_CADA,
+    OPCION_SALIDA_RUTA,
+    OPCION_ESTADISTICAS,
+    OPCION_BENCHMARK,
+    OPCION_TAMANOS,
+    OPCION_DENSIDADES,
+    OPCION_HILOS,
+    OPCION_BENCHMARK_RUTA,
+    OPCION_ENSAMBLE,
+    OPCION_REPLICAS,
+    OPCION_ENSAMBLE_RUTA,
+    OPCION_TRAZA,
+    OPCION_TOPOLOGIA,
+    OPCION_VECINDAD,
+    OPCION_DISTRIBUCION,
+    OPCION_DISCO,
+    OPCION_PRESUPUESTO,
+    OPCION_PARAMETRO = 512,     // + PARAM_*
+};
 
-            int hizo_algo = 0;
-            int dest_i = i, dest_j = j;
-
-            // 2. Verificar si hay carnívoros cerca (huir tiene prioridad)
-            int hay_carnivoro_cerca = 0;
-            for (int d = 0; d < 4; d++) {
-                int ni = i + dx[d];
-                int nj = j + dy[d];
-                if (es_valida(ni, nj) && ecosistema[ni][nj].tipo == CARNIVORE) {
-                    hay_carnivoro_cerca = 1;
-                    break;
-                }
-            }
+// Lee un entero positivo de la línea de comandos
+static int leer_entero(const char *texto, long minimo, long *valor) {
+    char *fin;
+    long v = strtol(texto, &fin, 10);
+    if (*texto == '\0' || *fin != '\0' || v < minimo) return -1;
+    *valor = v;
+    return 0;
+}
 
-            // 3. Huir de carnívoros (prioridad máxima)
-            if (hay_carnivoro_cerca) {
-                for (int d = 0; d < 4 && !hizo_algo; d++) {
-                    int ni = i + dx[d];
-                    int nj = j + dy[d];
-                    if (es_valida(ni, nj) && ecosistema[ni][nj].tipo == EMPTY) {
-                        // Verificar que la celda de escape no tenga carnívoros cerca
-                        int escape_seguro = 1;
-                        for (int d2 = 0; d2 < 4; d2++) {
-                            int ni2 = ni + dx[d2];
-                            int nj2 = nj + dy[d2];
-                            if (es_valida(ni2, nj2) && ecosistema[ni2][nj2].tipo == CARNIVORE) {
-                                escape_seguro = 0;
-                                break;
-                            }
-                        }
-
-                        if (escape_seguro) {
-                            lock_two(ni, nj, i, j);
-                            copia[ni][nj].tipo = HERBIVORE;
-                            copia[ni][nj].energia = ecosistema[i][j].energia;
-                            copia[ni][nj].ticks_sin_comer = ecosistema[i][j].ticks_sin_comer + 1;
-                            copia[ni][nj].edad = ecosistema[i][j].edad + 1;
-                            copia[i][j].tipo = EMPTY;
-                            unlock_two(ni, nj, i, j);
-
-                            dest_i = ni; dest_j = nj;
-                            hizo_algo = 1;
-                            break;
-                        }
-                    }
-                }
-            }
+// Lee una lista de enteros separados por comas; devuelve cuántos leyó o -1
+static int leer_lista(const char *texto, long minimo, long maximo, long *valores) {
+    int n = 0;
+    const char *p = texto;
+    while (n < MAX_BARRIDO) {
+        char *fin;
+        long v = strtol(p, &fin, 10);
+        if (fin == p || v < minimo || v > maximo || (*fin != ',' && *fin != '\0')) return -1;
+        valores[n++] = v;
+        if (*fin == '\0') return n;
+        p = fin + 1;
+    }
+    return -1;
+}
 
-            // 4. Comer plantas (si no huyó)
-            if (!hizo_algo) {
-                for (int d = 0; d < 4 && !hizo_algo; d++) {
-                    int ni = i + dx[d];
-                    int nj = j + dy[d];
-                    if (es_valida(ni, nj) && ecosistema[ni][nj].tipo == PLANT) {
-                        lock_two(ni, nj, i, j);
-                        copia[ni][nj].tipo = HERBIVORE;
-                        copia[ni][nj].energia = ecosistema[i][j].energia + 1; // Gana 1 energía
-                        copia[ni][nj].ticks_sin_comer = 0; // Resetea hambre
-                        copia[ni][nj].edad = ecosistema[i][j].edad + 1;
-                        copia[i][j].tipo = EMPTY;
-                        unlock_two(ni, nj, i, j);
-
-                        dest_i = ni; dest_j = nj;
-                        hizo_algo = 1;
-                        break;
-                    }
-                }
+// Devuelve 0 si hay que simular, 1 si solo se pidió ayuda y -1 si hay error
+int leer_argumentos(int argc, char **argv, Config *cfg) {
+    static const struct option opciones[] = {
+        {"ancho",      required_argument, NULL, 'W'},
+        {"alto",       required_argument, NULL, 'H'},
+        {"tamano",     required_argument, NULL, 'n'},
+        {"ticks",      required_argument, NULL, 't'},
+        {"plantas",    required_argument, NULL, 'p'},
+        {"herbivoros", required_argument, NULL, 'e'},
+        {"carnivoros", required_argument, NULL, 'c'},
+        {"max-hambre", required_argument, NULL, OPCION_PARAMETRO + PARAM_HAMBRE},
+        {"energia-reproduccion", required_argument, NULL, OPCION_PARAMETRO + PARAM_REPRODUCCION},
+        {"energia-cria", required_argument, NULL, OPCION_PARAMETRO + PARAM_ENERGIA_CRIA},
+        {"edad-maxima", required_argument, NULL, OPCION_PARAMETRO + PARAM_EDAD},
+        {"prob-siembra", required_argument, NULL, OPCION_PARAMETRO + PARAM_SIEMBRA},
+        {"radio-percepcion", required_argument, NULL, OPCION_PARAMETRO + PARAM_PERCEPCION},
+        {"semilla",    required_argument, NULL, 's'},
+        {"modo",       required_argument, NULL, 'm'},
+        {"distribucion", required_argument, NULL, OPCION_DISTRIBUCION},
+        {"topologia",  required_argument, NULL, OPCION_TOPOLOGIA},
+        {"vecindad",   required_argument, NULL, OPCION_VECINDAD},
+        {"checkpoint-cada", required_argument, NULL, OPCION_CHECKPOINT_CADA},
+        {"checkpoint-ruta", required_argument, NULL, OPCION_CHECKPOINT_RUTA},
+        {"comprimir",  no_argument,       NULL, OPCION_COMPRIMIR},
+        {"restaurar",  required_argument, NULL, OPCION_RESTAURAR},
+        {"salida",     required_argument, NULL, 'o'},
+        {"salida-cada", required_argument, NULL, OPCION_SALIDA_CADA},
+        {"salida-ruta", required_argument, NULL, OPCION_SALIDA_RUTA},
+        {"estadisticas", required_argument, NULL, OPCION_ESTADISTICAS},
+        {"benchmark",  no_argument,       NULL, OPCION_BENCHMARK},
+        {"tamanos",    required_argument, NULL, OPCION_TAMANOS},
+        {"densidades", required_argument, NULL, OPCION_DENSIDADES},
+        {"hilos",      required_argument, NULL, OPCION_HILOS},
+        {"benchmark-ruta", required_argument, NULL, OPCION_BENCHMARK_RUTA},
+        {"ensamble",   no_argument,       NULL, OPCION_ENSAMBLE},
+        {"replicas",   required_argument, NULL, OPCION_REPLICAS},
+        {"ensamble-ruta", required_argument, NULL, OPCION_ENSAMBLE_RUTA},
+        {"traza",      required_argument, NULL, OPCION_TRAZA},
+        {"disco",      required_argument, NULL, OPCION_DISCO},
+        {"presupuesto-mb", required_argument, NULL, OPCION_PRESUPUESTO},
+        {"ayuda",      no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int op;
+    long v;
+    while ((op = getopt_long(argc, argv, "W:H:n:t:p:e:c:s:m:o:h", opciones, NULL)) != -1) {
+        // Reglas y poblaciones: uno o más valores
+        int param = op == 'p' ? PARAM_PLANTAS
+                  : op == 'e' ? PARAM_HERBIVOROS
+                  : op == 'c' ? PARAM_CARNIVOROS
+                  : op >= OPCION_PARAMETRO ? op - OPCION_PARAMETRO : -1;
+        if (param >= 0) {
+            int n = leer_lista(optarg, PARAMETROS[param].minimo, PARAMETROS[param].maximo, cfg->valores[param]);
+            if (n < 0) {
+                fprintf(stderr, "Valor inválido para --%s: %s\n", PARAMETROS[param].opcion, optarg);
+                return -1;
             }
+            cfg->num_valores[param] = n;
+            continue;
+        }
 
-            // 5. Reproducirse (si no huyó ni comió, y tiene energía suficiente)
-            if (!hizo_algo && ecosistema[i][j].energia >= ENERGIA_REPRODUCCION) {
-                for (int d = 0; d < 4 && !hizo_algo; d++) {
-                    int ni = i + dx[d];
-                    int nj = j + dy[d];
-                    if (es_valida(ni, nj) && ecosistema[ni][nj].tipo == EMPTY) {
-                        lock_two(ni, nj, i, j);
-                        copia[ni][nj].tipo = HERBIVORE;
-                        copia[ni][nj].energia = ENERGIA_NUEVO;
-                        copia[ni][nj].ticks_sin_comer = 0;
-                        copia[ni][nj].edad = 0;
-
-                        copia[i][j].energia -= 2; // Costo de reproducción
-                        copia[i][j].edad++; // Envejece
-                        unlock_two(ni, nj, i, j);
-
-                        hizo_algo = 1;
-                        break;
-                    }
+        switch (op) {
+            case 'h':
+                imprimir_uso(argv[0]);
+                return 1;
+            case '?':
+                imprimir_uso(argv[0]);
+                return -1;
+            case 's': {
+                char *fin;
+                cfg->semilla = strtoull(optarg, &fin, 0);
+                if (*optarg == '\0' || *fin != '\0') {
+                    fprintf(stderr, "Valor inválido para -s: %s\n", optarg);
+                    return -1;
                 }
+                cfg->semilla_dada = true;
+                continue;
             }
-
-            // 6. Moverse hacia plantas (si no hizo nada más)
-            if (!hizo_algo) {
-                // Buscar plantas cercanas primero
-                int mejor_x = -1, mejor_y = -1;
-                for (int d = 0; d < 4; d++) {
-                    int ni = i + dx[d];
-                    int nj = j + dy[d];
-                    if (es_valida(ni, nj) && ecosistema[ni][nj].tipo == EMPTY) {
-                        // Verificar si hay plantas cerca de esta posición
-                        int cerca_plant = 0;
-                        for (int d2 = 0; d2 < 4; d2++) {
-                            int ni2 = ni + dx[d2];
-                            int nj2 = nj + dy[d2];
-                            if (es_valida(ni2, nj2) && ecosistema[ni2][nj2].tipo == PLANT) {
-                                cerca_plant = 1;
-                                break;
-                            }
-                        }
-                        if (cerca_plant) {
-                            mejor_x = ni;
-                            mejor_y = nj;
-                            break;
-                        }
-                    }
+            case 'm':
+                if (strcmp(optarg, "auto") == 0) cfg->modo = MODO_AUTO;
+                else if (strcmp(optarg, "denso") == 0) cfg->modo = MODO_DENSO;
+                else if (strcmp(optarg, "disperso") == 0) cfg->modo = MODO_DISPERSO;
+                else {
+                    fprintf(stderr, "Modo inválido: %s (auto, denso o disperso)\n", optarg);
+                    return -1;
                 }
-
-                // Si encontró una buena posición, moverse ahí
-                if (mejor_x != -1) {
-                    lock_two(mejor_x, mejor_y, i, j);
-                    copia[mejor_x][mejor_y].tipo = HERBIVORE;
-                    copia[mejor_x][mejor_y].energia = ecosistema[i][j].energia;
-                    copia[mejor_x][mejor_y].ticks_sin_comer = ecosistema[i][j].ticks_sin_comer + 1;
-                    copia[mejor_x][mejor_y].edad = ecosistema[i][j].edad + 1;
-                    copia[i][j].tipo = EMPTY;
-                    unlock_two(mejor_x, mejor_y, i, j);
-
-                    dest_i = mejor_x; dest_j = mejor_y;
-                    hizo_algo = 1;
-                } else {
-                    // Movimiento aleatorio si no hay plantas cerca
-                    for (int d = 0; d < 4 && !hizo_algo; d++) {
-                        int ni = i + dx[d];
-                        int nj = j + dy[d];
-                        if (es_valida(ni, nj) && ecosistema[ni][nj].tipo == EMPTY) {
-                            lock_two(ni, nj, i, j);
-                            copia[ni][nj].tipo = HERBIVORE;
-                            copia[ni][nj].energia = ecosistema[i][j].energia;
-                            copia[ni][nj].ticks_sin_comer = ecosistema[i][j].ticks_sin_comer + 1;
-                            copia[ni][nj].edad = ecosistema[i][j].edad + 1;
-                            copia[i][j].tipo = EMPTY;
-                            unlock_two(ni, nj, i, j);
-
-                            dest_i = ni; dest_j = nj;
-                            hizo_algo = 1;
-                            break;
-                        }
-                    }
+                continue;
+            case OPCION_DISTRIBUCION:
+                free(cfg->distribucion.peso);
+                if (leer_distribucion(optarg, &cfg->distribucion) != 0) return -1;
+                continue;
+            case OPCION_TOPOLOGIA:
+                if (strcmp(optarg, "acotada") == 0) cfg->toroide = false;
+                else if (strcmp(optarg, "toroide") == 0) cfg->toroide = true;
+                else {
+                    fprintf(stderr, "Topología inválida: %s (acotada o toroide)\n", optarg);
+                    return -1;
                 }
-            }
-
-            // 7. Si no pudo hacer nada, permanece y envejece
-            if (!hizo_algo) {
-                lock_cell(i, j);
-                copia[i][j].ticks_sin_comer++;
-                copia[i][j].edad++;
-                unlock_cell(i, j);
-            }
+                continue;
+            case OPCION_VECINDAD:
+                if (strcmp(optarg, "4") == 0) cfg->vecinos = 4;
+                else if (strcmp(optarg, "8") == 0) cfg->vecinos = 8;
+                else {
+                    fprintf(stderr, "Vecindad inválida: %s (4 u 8)\n", optarg);
+                    return -1;
+                }
+                continue;
+            case OPCION_CHECKPOINT_RUTA:
+                cfg->checkpoint_ruta = optarg;
+                continue;
+            case OPCION_COMPRIMIR:
+                cfg->comprimir = true;
+                continue;
+            case OPCION_RESTAURAR:
+                cfg->restaurar = optarg;
+                continue;
+            case OPCION_CHECKPOINT_CADA:
+                if (leer_entero(optarg, 0, &v) != 0 || v > INT32_MAX) {
+                    fprintf(stderr, "Valor inválido para --checkpoint-cada: %s\n", optarg);
+                    return -1;
+                }
+                cfg->checkpoint_cada = (int) v;
+                continue;
+            case 'o':
+                cfg->salida = -1;
+                for (int s = 0; s <= SALIDA_NINGUNA; s++)
+                    if (strcmp(optarg, NOMBRES_SALIDA[s]) == 0) cfg->salida = s;
+                if (cfg->salida < 0) {
+                    fprintf(stderr, "Salida inválida: %s (ascii, binario, ppm, pgm, resumen o ninguna)\n", optarg);
+                    return -1;
+                }
+                continue;
+            case OPCION_SALIDA_RUTA:
+                cfg->salida_ruta = optarg;
+                continue;
+            case OPCION_ESTADISTICAS:
+                cfg->estadisticas = optarg;
+                continue;
+            case OPCION_BENCHMARK:
+                cfg->benchmark = true;
+                continue;
+            case OPCION_BENCHMARK_RUTA:
+                cfg->benchmark_ruta = optarg;
+                continue;
+            case OPCION_TAMANOS:
+                if ((cfg->num_tamanos = leer_lista(optarg, 1, 1L << 20, cfg->tamanos)) < 0) {
+                    fprintf(stderr, "Lista inválida para --tamanos: %s\n", optarg);
+                    return -1;
+                }
+                continue;
+            case OPCION_DENSIDADES:
+                if ((cfg->num_densidades = leer_lista(optarg, 0, 100, cfg->densidades)) < 0) {
+                    fprintf(stderr, "Lista inválida para --densidades: %s\n", optarg);
+                    return -1;
+                }
+                continue;
+            case OPCION_HILOS:
+                if ((cfg->num_hilos = leer_lista(optarg, 1, 4096, cfg->hilos)) < 0) {
+                    fprintf(stderr, "Lista inválida para --hilos: %s\n", optarg);
+                    return -1;
+                }
+                continue;
+            case OPCION_ENSAMBLE:
+                cfg->ensamble = true;
+                continue;
+            case OPCION_ENSAMBLE_RUTA:
+                cfg->ensamble_ruta = optarg;
+                continue;
+            case OPCION_TRAZA:
+#ifdef ECO_INSTRUMENTAR
+                cfg->traza = optarg;
+                continue;
+#else
+                fprintf(stderr, "--traza requiere compilar con -DECO_INSTRUMENTAR\n");
+                return -1;
+#endif
+            case OPCION_REPLICAS:
+                if (leer_entero(optarg, 1, &v) != 0 || v > INT32_MAX) {
+                    fprintf(stderr, "Valor inválido para --replicas: %s\n", optarg);
+                    return -1;
+                }
+                cfg->replicas = (int) v;
+                continue;
+            case OPCION_SALIDA_CADA:
+                if (leer_entero(optarg, 1, &v) != 0 || v > INT32_MAX) {
+                    fprintf(stderr, "Valor inválido para --salida-cada: %s\n", optarg);
+                    return -1;
+                }
+                cfg->salida_cada = (int) v;
+                continue;
+            case OPCION_DISCO:
+                cfg->disco = optarg;
+                continue;
+            case OPCION_PRESUPUESTO:
+                if (leer_entero(optarg, 1, &v) != 0 || v > (long) (SIZE_MAX >> 20)) {
+                    fprintf(stderr, "Valor inválido para --presupuesto-mb: %s\n", optarg);
+                    return -1;
+                }
+                cfg->presupuesto = (size_t) v << 20;
+                continue;
+        }
 
-            // 8. Pierde energía (si sigue vivo) -> decrementar en celda final
-            lock_cell(dest_i, dest_j);
-            if (copia[dest_i][dest_j].tipo == HERBIVORE) copia[dest_i][dest_j].energia--;
-            unlock_cell(dest_i, dest_j);
+        long minimo = op == 't' ? 0 : 1;
+        if (leer_entero(optarg, minimo, &v) != 0 ||
+            v > INT32_MAX) {
+            fprintf(stderr, "Valor inválido para -%c: %s\n", op, optarg);
+            return -1;
+        }
+        switch (op) {
+            case 'W': cfg->ancho = (int) v; break;
+            case 'H': cfg->alto = (int) v; break;
+            case 'n': cfg->ancho = cfg->alto = (int) v; break;
+            case 't': cfg->ticks = (int) v; break;
         }
     }
 
-    // Aplicar cambios (single-thread)
-    for (int i = 0; i < N; i++)
-        for (int j = 0; j < N; j++)
-            ecosistema[i][j] = copia[i][j];
+    for (int p = 0; p < NUM_PARAMETROS; p++)
+        if (cfg->num_valores[p] > 1 && !cfg->ensamble) {
+            fprintf(stderr, "--%s acepta una lista de valores solo con --ensamble\n", PARAMETROS[p].opcion);
+            return -1;
+        }
+    if (cfg->traza != NULL && (cfg->benchmark || cfg->ensamble)) {
+        fprintf(stderr, "--traza no se puede usar con --benchmark ni --ensamble\n");
+        return -1;
+    }
+    if (cfg->disco != NULL) {
+        // Fuera de memoria solo hay modo denso, y nada que copie la rejilla
+        // entera en memoria
+        if (cfg->ensamble || cfg->modo == MODO_DISPERSO || cfg->checkpoint_cada > 0) {
+            fprintf(stderr, "--disco no se puede usar con --ensamble, -m disperso ni --checkpoint-cada\n");
+            return -1;
+        }
+        cfg->modo = MODO_DENSO;
+        if (cfg->salida != SALIDA_NINGUNA) cfg->salida = SALIDA_RESUMEN;
+    }
+    return 0;
 }
 
-// ---------------------------------- MAIN ----------------------------------
-
-int main() {
-    srand(time(NULL));
-
-    // Inicializar locks
-    for (int i = 0; i < N; i++)
-        for (int j = 0; j < N; j++)
-            omp_init_lock(&locks[i][j]);
+int main(int argc, char **argv) {
+#ifdef USE_MPI
+    int nivel;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_SERIALIZED, &nivel);
+    atexit(terminar_mpi);
+#endif
+    // Valores por defecto (las poblaciones son caps a ancho*alto)
+    Config cfg = {
+        .ancho = 50,
+        .alto = 50,
+        .ticks = 10,
+        .valores = {
+            [PARAM_HAMBRE] = {REGLAS_BASE.max_ticks_sin_comer},
+            [PARAM_REPRODUCCION] = {REGLAS_BASE.energia_reproduccion},
+            [PARAM_ENERGIA_CRIA] = {REGLAS_BASE.energia_nuevo},
+            [PARAM_EDAD] = {REGLAS_BASE.edad_maxima},
+            [PARAM_SIEMBRA] = {REGLAS_BASE.prob_siembra},
+            [PARAM_PERCEPCION] = {REGLAS_BASE.radio_percepcion},
+            [PARAM_PLANTAS] = {300},
+            [PARAM_HERBIVOROS] = {200},
+            [PARAM_CARNIVOROS] = {75},
+        },
+        .num_valores = {1, 1, 1, 1, 1, 1, 1, 1, 1},
+        .replicas = 1,
+        .semilla = (uint64_t) time(NULL),
+        .modo = MODO_AUTO,
+        .vecinos = 4,
+        .checkpoint_ruta = "ecosistema.chk",
+        .salida = SALIDA_ASCII,
+        .salida_cada = 1,
+        .presupuesto = (size_t) 1024 << 20,
+        .tamanos = {256, 1024, 2048},
+        .num_tamanos = 3,
+        .densidades = {5, 20, 50},
+        .num_densidades = 3,
+    };
+    int r = leer_argumentos(argc, argv, &cfg);
+    if (r != 0) return r < 0 ? EXIT_FAILURE : 0;
+#ifdef USE_MPI
+    if (procesos_mpi() > 1) return correr_distribuido(&cfg) != 0 ? EXIT_FAILURE : 0;
+#endif
+    if (cfg.benchmark) return correr_benchmark(&cfg) != 0 ? EXIT_FAILURE : 0;
+    if (cfg.ensamble) return correr_ensamble(&cfg) != 0 ? EXIT_FAILURE : 0;
 
-    // Ajusta estos números (serán caps a N*N)
-    int num_plantas = 300;
-    int num_herviboros = 200;
-    int num_carnivoros = 75;
+    Mundo mundo;
+    if (cfg.restaurar != NULL) {
+        if (restaurar_checkpoint(&mundo, cfg.restaurar, cfg.disco, cfg.presupuesto) != 0) return EXIT_FAILURE;
+        printf("Restaurado de %s en el tick %ld\n", cfg.restaurar, mundo.tick);
+    } else {
+        if (crear_mundo(&mundo, cfg.ancho, cfg.alto, cfg.disco, cfg.presupuesto) != 0) {
+            fprintf(stderr, "Sin memoria para un ecosistema de %dx%d\n", cfg.ancho, cfg.alto);
+            return EXIT_FAILURE;
+        }
+        long valores[NUM_PARAMETROS];
+        valores_variante(&cfg, 0, valores);
+        fijar_topologia(&mundo, cfg.toroide, cfg.toroide, cfg.vecinos);
+        mundo.reglas = reglas_de(valores);
+        mundo.semilla = cfg.semilla;
+        mundo.tick = 0;
+        if (inicializar_ecosistema(&mundo, &cfg.distribucion,
+                                   valores[PARAM_PLANTAS], valores[PARAM_HERBIVOROS], valores[PARAM_CARNIVOROS]) != 0) {
+            fprintf(stderr, "Sin memoria para colocar la población inicial\n");
+            destruir_mundo(&mundo);
+            return EXIT_FAILURE;
+        }
+    }
+    mundo.modo = cfg.modo;
+    recontar_poblacion(&mundo);
+    if (cfg.disco != NULL) soltar_disco(&mundo);
+#ifdef ECO_INSTRUMENTAR
+    mundo.trazar = cfg.traza != NULL;
+#endif
 
-    int num_TICKS = 10;
+    Checkpoint chk = {.cada = cfg.checkpoint_cada, .ruta = cfg.checkpoint_ruta, .comprimir = cfg.comprimir};
+    Escritor escritor = {0};
+    if (crear_checkpoint(&chk, &mundo) != 0) {
+        fprintf(stderr, "Sin memoria para los checkpoints\n");
+        destruir_mundo(&mundo);
+        return EXIT_FAILURE;
+    }
+    Salida salida = {.tipo = cfg.salida, .cada = cfg.salida_cada, .ruta = cfg.salida_ruta};
+    if (crear_salida(&salida, &mundo) != 0) {
+        fprintf(stderr, "No se pudo preparar la salida\n");
+        destruir_salida(&salida);
+        destruir_checkpoint(&chk);
+        destruir_mundo(&mundo);
+        return EXIT_FAILURE;
+    }
+    Estadisticas est;
+    if (abrir_estadisticas(&est, cfg.estadisticas) != 0) {
+        destruir_salida(&salida);
+        destruir_checkpoint(&chk);
+        destruir_mundo(&mundo);
+        return EXIT_FAILURE;
+    }
+    if ((chk.cada > 0 || salida.tipo != SALIDA_NINGUNA) && iniciar_escritor(&escritor) != 0)
+        fprintf(stderr, "Sin hilo escritor: la salida se escribe en línea\n");
 
-    inicializar_ecosistema(num_plantas, num_herviboros, num_carnivoros);
     printf("Ecosistema Inicial:\n");
-    printf("Celdas disponibles: %d\n", N * N);
-    imprimir_resumen();
+    printf("Celdas disponibles: %zu\n", mundo.celdas);
+    printf("Semilla: %llu\n", (unsigned long long) mundo.semilla);
+    imprimir_resumen(&mundo);
     
+    long tick0 = mundo.tick;
+    double inicio = omp_get_wtime();
     #pragma omp parallel
     {
-        for (int t = 0; t < num_TICKS; t++) {
+        construir_mascaras(&mundo);
+        ajustar_modo(&mundo);
 
-            // Herbívoros primero
-            #pragma omp single
-            herbivore_update();
+        for (long t = mundo.tick; t < cfg.ticks; t++) {
+            avanzar_tick(&mundo);
 
-            // Plantas y carnívoros al mismo tiempo
-            #pragma omp sections
+            #pragma omp single
             {
-                #pragma omp section
-                plant_update();
-
-                #pragma omp section
-                carnivore_update();
+                mundo.tick++;
+                registrar_estadisticas(&est, &mundo);
             }
 
-            // Impresión (solo un hilo)
-            #pragma omp single
+            // El equipo arma el cuadro y el escritor lo vuelca en segundo plano
+            if (mundo.tick % salida.cada == 0)
+                emitir_cuadro(&mundo, &salida, &escritor);
+
+            #pragma omp single nowait
             {
-                imprimir_resumen();
-                imprimir_ecosistema();
+                mundo.bytes_tick = 0;
+                mundo.eventos = (Contadores) {0};
             }
 
-            // Sincronización antes del siguiente tick
-            #pragma omp barrier
+            if (chk.cada > 0 && mundo.tick % chk.cada == 0)
+                guardar_checkpoint(&mundo, &chk, &escritor);
         }
     }
 
-    // Destruir locks
-    for (int i = 0; i < N; i++)
-        for (int j = 0; j < N; j++)
-            omp_destroy_lock(&locks[i][j]);
+    double segundos = omp_get_wtime() - inicio;
 
-    return 0;
-}
\ No newline at end of file
+    detener_escritor(&escritor);
+    destruir_salida(&salida);
+    cerrar_estadisticas(&est);
+    if (cfg.disco != NULL) {
+        const Disco *d = &mundo.disco;
+        size_t residente = memoria_residente();
+        if (d->residente_max > residente) residente = d->residente_max;
+        double celdas_s = segundos > 0 ? (double) mundo.celdas * (double) (mundo.tick - tick0) / segundos : 0;
+        printf("Fuera de memoria: %d franjas de %d filas, %.0f celdas/s\n", d->num_franjas, d->filas_franja, celdas_s);
+        printf("Memoria residente máxima: %.1f MB (presupuesto de la rejilla: %.1f MB)\n",
+               (double) residente / (1 << 20), (double) d->presupuesto / (1 << 20));
+    }
+    printf("Firma final: %016llx\n", (unsigned long long) firma_ecosistema(&mundo));
+    int salida_error = 0;
+#ifdef ECO_INSTRUMENTAR
+    if (cfg.traza != NULL) {
+        imprimir_instrumentacion(&mundo);
+        salida_error = escribir_traza(&mundo, cfg.traza) != 0;
+    }
+#endif
+    destruir_checkpoint(&chk);
+    destruir_mundo(&mundo);
+    return salida_error ? EXIT_FAILURE : 0;
+}